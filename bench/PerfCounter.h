@@ -0,0 +1,71 @@
+#pragma once
+
+// Counts user-space instructions retired by the calling thread, and by threads it
+// starts afterwards, through perf_event_open. Where the kernel or the machine does not expose the counter
+// (containers, VMs without a PMU, perf_event_paranoid > 2) available() is false
+// and the benchmarks report the count as unavailable.
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class PerfCounter
+{
+public:
+    PerfCounter()
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // also count threads started after the counter is opened
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~PerfCounter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    PerfCounter(const PerfCounter &) = delete;
+    PerfCounter &operator=(const PerfCounter &) = delete;
+
+    bool available() const { return fd >= 0; }
+
+    void start()
+    {
+        if (fd < 0)
+            return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    void stop()
+    {
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    // instructions between start() and stop(), -1 when the counter is unavailable.
+    // Threads started after the counter was opened are only included once they
+    // have exited, so read this after joining them.
+    long long count() const
+    {
+        if (fd < 0)
+            return -1;
+        long long value = 0;
+        if (read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value))
+            return -1;
+        return value;
+    }
+
+private:
+    int fd = -1;
+};
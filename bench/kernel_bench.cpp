@@ -0,0 +1,189 @@
+// Microbenchmark of the per-candidate kernel work in the density and pressure
+// passes: the old path (a length() in the neighbor filter, another in the pass,
+// and the kernel squaring r again) against the r^2-based entry points, and the
+// pressure pair term computed from densities on every pair against the
+// precomputed per-particle terms. Instructions per candidate are reported where
+// perf_event_open is available.
+//
+//   make kernel_bench && ./kernel_bench [candidates] [repeats]
+
+#include "Particle.h"
+#include "PerfCounter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement
+{
+    double ns;           // per candidate
+    double instructions; // per candidate, negative when not available
+};
+
+template <typename Fn>
+static Measurement measure(int count, int repeats, Fn &&fn)
+{
+    PerfCounter counter;
+    counter.start();
+    auto start = Clock::now();
+    for (int r = 0; r < repeats; r++)
+    {
+        fn();
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    counter.stop();
+
+    double candidates = (double)count * repeats;
+    long long instructions = counter.count();
+    return {ns / candidates, instructions < 0 ? -1.0 : instructions / candidates};
+}
+
+static void report(const char *name, const char *oldName, Measurement before,
+                   const char *newName, Measurement after)
+{
+    printf("%-9s %-13s %6.3f ns  %-13s %6.3f ns  speedup %.2fx", name, oldName, before.ns,
+           newName, after.ns, before.ns / after.ns);
+    if (before.instructions >= 0.0 && after.instructions >= 0.0)
+        printf("  instructions %.1f -> %.1f", before.instructions, after.instructions);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    int repeats = argc > 2 ? atoi(argv[2]) : 20;
+
+    Particle p(1280, 720);
+    float sr = p.smoothingRadius;
+    float sr2 = sr * sr;
+
+    // candidates from a 3x3 cell block around the sample, like a grid query
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> offset(-1.5f * sr, 1.5f * sr);
+    std::vector<glm::vec2> candidates(count);
+    for (glm::vec2 &c : candidates)
+    {
+        c = {offset(rng), offset(rng)};
+    }
+
+    // per-candidate densities and the precomputed terms the force pass now reads
+    std::uniform_real_distribution<float> densityValue(1.5f, 2.5f);
+    std::vector<float> densities(count), pressures(count), inverseDensities(count);
+    for (int j = 0; j < count; j++)
+    {
+        densities[j] = densityValue(rng);
+        pressures[j] = p.convertDensityToPressure(densities[j]);
+        inverseDensities[j] = 1.0f / densities[j];
+    }
+    float density = 2.1f;
+    float pressure = p.convertDensityToPressure(density);
+    float inverseDensity = 1.0f / density;
+
+    volatile float sink = 0.0f;
+
+    Measurement densityOld = measure(count, repeats, [&]
+    {
+        float sum = 0.0f;
+        for (glm::vec2 vec : candidates)
+        {
+            if (glm::length(vec) < sr)
+            {
+                float dst = glm::length(vec);
+                sum += p.smoothingKernel(sr, dst);
+            }
+        }
+        sink = sink + sum;
+    });
+
+    Measurement densityNew = measure(count, repeats, [&]
+    {
+        float sum = 0.0f;
+        for (glm::vec2 vec : candidates)
+        {
+            float dst2 = glm::dot(vec, vec);
+            if (dst2 < sr2)
+            {
+                sum += p.smoothingKernelSq(sr2, dst2);
+            }
+        }
+        sink = sink + sum;
+    });
+
+    Measurement gradientOld = measure(count, repeats, [&]
+    {
+        glm::vec2 sum(0.0f);
+        for (glm::vec2 vec : candidates)
+        {
+            if (glm::length(vec) < sr)
+            {
+                float dst = glm::length(vec);
+                if (dst > 0.0f)
+                    sum += p.smoothingKernelGradient(sr, vec);
+            }
+        }
+        sink = sink + sum.x + sum.y;
+    });
+
+    Measurement gradientNew = measure(count, repeats, [&]
+    {
+        glm::vec2 sum(0.0f);
+        for (glm::vec2 vec : candidates)
+        {
+            float dst2 = glm::dot(vec, vec);
+            if (dst2 < sr2 && dst2 > 0.0f)
+            {
+                float dst = std::sqrt(dst2);
+                sum += p.smoothingKernelGradient(sr, dst, vec / dst);
+            }
+        }
+        sink = sink + sum.x + sum.y;
+    });
+
+    Measurement pressureOld = measure(count, repeats, [&]
+    {
+        glm::vec2 sum(0.0f);
+        for (int j = 0; j < count; j++)
+        {
+            glm::vec2 vec = candidates[j];
+            float dst2 = glm::dot(vec, vec);
+            if (dst2 < sr2 && dst2 > 0.0f)
+            {
+                float dst = std::sqrt(dst2);
+                glm::vec2 gradW = p.smoothingKernelGradient(sr, dst, vec / dst);
+                float pressure_i = p.convertDensityToPressure(density);
+                float pressure_j = p.convertDensityToPressure(densities[j]);
+                float sharedPressure = (pressure_i + pressure_j) / 2.0f;
+                sum += -p.mass * p.mass * sharedPressure * (1.0f / densities[j] + 1.0f / density) * gradW;
+            }
+        }
+        sink = sink + sum.x + sum.y;
+    });
+
+    Measurement pressureNew = measure(count, repeats, [&]
+    {
+        glm::vec2 sum(0.0f);
+        for (int j = 0; j < count; j++)
+        {
+            glm::vec2 vec = candidates[j];
+            float dst2 = glm::dot(vec, vec);
+            if (dst2 < sr2 && dst2 > 0.0f)
+            {
+                float dst = std::sqrt(dst2);
+                float pairTerm = (pressure + pressures[j]) * (inverseDensity + inverseDensities[j]);
+                sum += pairTerm * p.smoothingKernelGradient(sr, dst, vec / dst);
+            }
+        }
+        sink = sink + sum.x + sum.y;
+    });
+
+    printf("candidates %d, repeats %d\n", count, repeats);
+    report("density", "length-based", densityOld, "r^2-based", densityNew);
+    report("gradient", "length-based", gradientOld, "one-sqrt", gradientNew);
+    report("pressure", "per-pair", pressureOld, "precomputed", pressureNew);
+    if (!PerfCounter().available())
+        printf("instruction counts unavailable (perf_event_open failed)\n");
+    return 0;
+}
@@ -0,0 +1,507 @@
+// Solver benchmark over fixed scenes. Every run uses a fixed seed and dt, so two
+// builds can be compared step for step:
+//
+//   make sph_bench && ./sph_bench [--scenes block_drop,dam_break,settled_tank,pipe_flow]
+//                                 [--sizes 1000,10000,100000,1000000] [--threads N]
+//                                 [--steps N] [--warmup N] [--out results.jsonl]
+//                                 [--mode simd|scalar|cache|verlet|half] [--reorder]
+//                                 [--adaptive] [--symmetric] [--check-allocs]
+//
+// Each run prints one JSON object per line (stdout, or --out) with the per-phase
+// time per step, particle-steps/s, peak RSS, the solver's arena size and a
+// position checksum; a readable summary goes to stderr. Phase times come from the
+// solver's profiler and need a build with SPH_PROFILE (the Makefile default).
+// Runs happen in forked children so peak RSS is per run.
+//
+// Heap allocations made during the timed steps are counted through replaced
+// global operator new; update() should make none, and
+// --check-allocs turns any into a failure.
+//
+// Instructions retired per step, solver threads included, are counted with
+// perf_event_open and read null where no hardware counter is available.
+//
+// The domain grows with the particle count so every scene keeps the same fill
+// fraction and density whatever its size.
+
+#include "Particle.h"
+#include "PerfCounter.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> countingAllocations(false);
+static std::atomic<long long> allocationCount(0);
+
+static void *countedAllocate(size_t size, size_t alignment)
+{
+    if (countingAllocations.load(std::memory_order_relaxed))
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    // aligned_alloc wants the size rounded up to the alignment
+    size = std::max<size_t>(size, 1);
+    void *memory = alignment > alignof(std::max_align_t)
+                       ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                       : std::malloc(size);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void *operator new(size_t size) { return countedAllocate(size, 0); }
+void *operator new[](size_t size) { return countedAllocate(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return countedAllocate(size, (size_t)alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return countedAllocate(size, (size_t)alignment); }
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+
+struct Scene
+{
+    const char *name;
+    float fill; // fraction of the domain area covered by fluid
+    std::vector<glm::vec2> (*build)(float halfW, float halfH, float spacing, int count, unsigned int seed);
+    // emitters and kill volumes, for scenes whose particle count changes
+    void (*setup)(Particle &p, float halfW, float halfH, float spacing);
+};
+
+// rows of `columns` particles stacked up from the bottom-left corner `origin`;
+// gravity points along +y, so the floor is at +halfH
+static std::vector<glm::vec2> lattice(glm::vec2 origin, int columns, float spacing, int count)
+{
+    std::vector<glm::vec2> positions(count);
+    for (int i = 0; i < count; i++)
+    {
+        positions[i] = origin + glm::vec2((i % columns + 0.5f) * spacing, -(i / columns + 0.5f) * spacing);
+    }
+    return positions;
+}
+
+// MakeGrid's square block in the middle of the tank
+static std::vector<glm::vec2> blockDrop(float, float, float spacing, int count, unsigned int)
+{
+    int columns = (int)std::sqrt(count);
+    int rows = (count - 1) / columns + 1;
+    return lattice({-columns * spacing / 2.0f, rows * spacing / 2.0f}, columns, spacing, count);
+}
+
+// water column against the left wall, a third of the tank wide
+static std::vector<glm::vec2> damBreak(float halfW, float halfH, float spacing, int count, unsigned int)
+{
+    int columns = std::max(1, (int)(2.0f * halfW / 3.0f / spacing));
+    return lattice({-halfW, halfH}, columns, spacing, count);
+}
+
+// tank filled across its whole width, jittered so the lattice does not stay aligned
+static std::vector<glm::vec2> settledTank(float halfW, float halfH, float spacing, int count, unsigned int seed)
+{
+    int columns = std::max(1, (int)(2.0f * halfW / spacing));
+    std::vector<glm::vec2> positions = lattice({-halfW, halfH}, columns, spacing, count);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> jitter(-0.1f * spacing, 0.1f * spacing);
+    for (glm::vec2 &pos : positions)
+    {
+        pos += glm::vec2(jitter(rng), jitter(rng));
+    }
+    return positions;
+}
+
+// shallow pool fed by a pipe high on the left wall and drained through the floor
+// at the right end, so particles are emitted and removed every step
+static std::vector<glm::vec2> pipePool(float halfW, float halfH, float spacing, int count, unsigned int seed)
+{
+    return settledTank(halfW, halfH, spacing, count, seed);
+}
+
+static void pipeFlow(Particle &p, float halfW, float halfH, float spacing)
+{
+    float pipeWidth = 0.1f * halfH;
+    p.emitters.push_back({{-halfW + spacing, -0.5f * halfH}, {3.0f, 0.0f}, pipeWidth});
+    p.killVolumes.push_back({{halfW - 0.1f * halfW, halfH - 2.0f * spacing}, {halfW, halfH}});
+}
+
+static const Scene scenes[] = {
+    {"block_drop", 0.25f, blockDrop, nullptr},
+    {"dam_break", 0.25f, damBreak, nullptr},
+    {"settled_tank", 0.5f, settledTank, nullptr},
+    {"pipe_flow", 0.25f, pipePool, pipeFlow},
+};
+
+struct Options
+{
+    std::vector<std::string> scenes = {"block_drop", "dam_break", "settled_tank", "pipe_flow"};
+    std::vector<int> sizes = {1000, 10000, 100000, 1000000};
+    int threads = 1;
+    int steps = 0;  // 0 picks about 1e7 particle-steps per run
+    int warmup = -1; // -1 uses 1 for the falling scenes and steps for the tank
+    unsigned int seed = 1;
+    float dt = 1.0f / 120.0f;
+    std::string mode = "simd";
+    bool reorder = false;
+    bool adaptive = false;
+    bool symmetric = false;
+    bool checkAllocs = false;
+    std::string out;
+};
+
+// seconds per phase summed over the timed steps, from the solver's profiler
+struct PhaseSeconds
+{
+    double grid;
+    double neighborList; // part of grid
+    double density;
+    double pressure;
+    double integrate;
+    double boundaries;
+};
+
+// sent from the child back to the parent through a pipe
+struct RunResult
+{
+    int steps;
+    int warmup;
+    double seconds;
+    PhaseSeconds phases;
+    long long allocations;
+    long long substeps;
+    long long particleSteps; // particles summed over the timed steps
+    int finalParticles;
+    long long instructions; // -1 when not counted
+    size_t arenaBytes;
+    size_t neighborCacheBytes;
+    bool hugePages;
+    double checksum;
+};
+
+static RunResult runScene(const Scene &scene, int count, const Options &options)
+{
+    // 16:9 tank sized so the fluid covers scene.fill of it, in pixels (100 per unit)
+    float radius = 0.038f;
+    float spacing = 2.0f * radius;
+    float area = count * spacing * spacing / scene.fill;
+    float width = std::sqrt(area * 16.0f / 9.0f);
+    float height = area / width;
+
+    RunResult result = {};
+    // opened before the solver starts its threads so their instructions count too
+    PerfCounter instructions;
+    {
+        Particle p((int)std::ceil(width * 100.0f), (int)std::ceil(height * 100.0f), options.seed);
+        p.setThreadCount(options.threads);
+        p.useSimdKernels = options.mode != "scalar";
+        p.useNeighborCache = options.mode == "cache";
+        p.useVerletList = options.mode == "verlet";
+        p.useHalfNeighborList = options.mode == "half";
+        p.useSpatialReorder = options.reorder;
+        p.useAdaptiveTimestep = options.adaptive;
+        p.pressureFormulation =
+            options.symmetric ? PressureFormulation::Symmetric : PressureFormulation::SharedPressure;
+        p.radius = radius;
+        if (scene.setup)
+        {
+            // room for the inflow, so emitting does not re-plan the arena mid-run
+            p.reserveCapacity(2 * count);
+            scene.setup(p, width / 2.0f, height / 2.0f, spacing);
+        }
+        p.SetParticles(scene.build(width / 2.0f, height / 2.0f, spacing, count, options.seed));
+        p.running = true;
+
+        result.steps = options.steps > 0 ? options.steps : std::max(10, 10000000 / count);
+        result.warmup = options.warmup >= 0 ? options.warmup
+                                            : (std::strcmp(scene.name, "settled_tank") == 0 ? result.steps : 1);
+
+        for (int step = 0; step < result.warmup; step++)
+        {
+            p.update(options.dt);
+        }
+
+        p.profiler.reset();
+        long long substepsBefore = p.substepsTaken;
+        countingAllocations = true;
+        instructions.start();
+        Clock::time_point start = Clock::now();
+        for (int step = 0; step < result.steps; step++)
+        {
+            p.update(options.dt);
+            result.particleSteps += p.numParticles;
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        instructions.stop();
+        countingAllocations = false;
+        result.allocations = allocationCount;
+        result.substeps = p.substepsTaken - substepsBefore;
+        result.phases.grid = p.profiler.stats(ProfilePhase::Grid).total;
+        result.phases.neighborList = p.profiler.stats(ProfilePhase::NeighborList).total;
+        result.phases.density = p.profiler.stats(ProfilePhase::Density).total;
+        result.phases.pressure = p.profiler.stats(ProfilePhase::Pressure).total;
+        result.phases.integrate = p.profiler.stats(ProfilePhase::Integrate).total;
+        result.phases.boundaries = p.profiler.stats(ProfilePhase::Boundaries).total;
+        result.arenaBytes = p.arenaBytes();
+        result.neighborCacheBytes = p.usingNeighborList() ? p.neighborCacheBytes() : 0;
+        result.hugePages = p.arenaHugePages();
+
+        // summed in id order so reordering does not change it
+        const Vec2Array &positions = p.GetPositions();
+        for (int id = 0; id < p.GetIdCount(); id++)
+        {
+            int index = p.GetParticleIndex(id);
+            if (index < 0)
+                continue;
+            glm::vec2 pos = positions[index];
+            result.checksum += (double)pos.x + (double)pos.y;
+        }
+        result.finalParticles = p.numParticles;
+    }
+    // the worker threads have been joined, so their counts are folded in now
+    result.instructions = instructions.count();
+    return result;
+}
+
+// runs the scene in a child process; returns false if the child failed
+static bool runIsolated(const Scene &scene, int count, const Options &options, RunResult &result, long &peakRssKb)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        close(fds[0]);
+        RunResult childResult = runScene(scene, count, options);
+        bool written = write(fds[1], &childResult, sizeof(childResult)) == (ssize_t)sizeof(childResult);
+        _exit(written ? 0 : 1);
+    }
+
+    close(fds[1]);
+    bool received = read(fds[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage = {};
+    wait4(pid, &status, 0, &usage);
+    peakRssKb = usage.ru_maxrss;
+
+    return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static std::vector<std::string> splitList(const char *text)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static const Scene *findScene(const std::string &name)
+{
+    for (const Scene &scene : scenes)
+    {
+        if (name == scene.name)
+            return &scene;
+    }
+    return nullptr;
+}
+
+static bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (value && arg == "--scenes")
+            options.scenes = splitList(value);
+        else if (value && arg == "--sizes")
+        {
+            options.sizes.clear();
+            for (const std::string &size : splitList(value))
+                options.sizes.push_back(std::stoi(size));
+        }
+        else if (value && arg == "--threads")
+            options.threads = std::stoi(value);
+        else if (value && arg == "--steps")
+            options.steps = std::stoi(value);
+        else if (value && arg == "--warmup")
+            options.warmup = std::stoi(value);
+        else if (value && arg == "--seed")
+            options.seed = (unsigned int)std::stoul(value);
+        else if (value && arg == "--out")
+            options.out = value;
+        else if (value && arg == "--mode")
+            options.mode = value;
+        else if (arg == "--reorder")
+        {
+            options.reorder = true;
+            continue;
+        }
+        else if (arg == "--adaptive")
+        {
+            options.adaptive = true;
+            continue;
+        }
+        else if (arg == "--symmetric")
+        {
+            options.symmetric = true;
+            continue;
+        }
+        else if (arg == "--check-allocs")
+        {
+            options.checkAllocs = true;
+            continue;
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return false;
+        }
+        i++;
+    }
+
+    if (options.mode != "simd" && options.mode != "scalar" && options.mode != "cache" && options.mode != "verlet" &&
+        options.mode != "half")
+    {
+        fprintf(stderr, "unknown mode %s\n", options.mode.c_str());
+        return false;
+    }
+
+    for (const std::string &name : options.scenes)
+    {
+        if (!findScene(name))
+        {
+            fprintf(stderr, "unknown scene %s\n", name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--scenes a,b] [--sizes n,m] [--threads N] [--steps N] "
+                        "[--warmup N] [--seed S] [--out file] "
+                        "[--mode simd|scalar|cache|verlet|half] [--reorder] [--adaptive] [--symmetric] "
+                        "[--check-allocs]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (!options.out.empty())
+    {
+        out = fopen(options.out.c_str(), "w");
+        if (!out)
+        {
+            perror(options.out.c_str());
+            return 1;
+        }
+    }
+
+#ifdef SPH_SOA_LAYOUT
+    const char *layout = "soa";
+#else
+    const char *layout = "aos";
+#endif
+    const char *simd = simdLevelName(detectSimdLevel());
+
+    if (!kProfilingEnabled)
+        fprintf(stderr, "built without SPH_PROFILE, phase timings will read 0\n");
+
+    fprintf(stderr, "%-13s %9s %6s %8s %8s %8s %8s %8s %8s %12s %10s\n", "scene", "particles", "steps",
+            "grid", "nlist", "density", "pressure", "integr", "bounds", "p-steps/s", "rss MiB");
+
+    bool failed = false;
+    for (const std::string &name : options.scenes)
+    {
+        const Scene &scene = *findScene(name);
+        for (int count : options.sizes)
+        {
+            RunResult result;
+            long peakRssKb = 0;
+            if (!runIsolated(scene, count, options, result, peakRssKb))
+            {
+                fprintf(stderr, "%s with %d particles failed\n", scene.name, count);
+                failed = true;
+                continue;
+            }
+
+            // milliseconds per step
+            double scale = 1000.0 / result.steps;
+            const PhaseSeconds &t = result.phases;
+            double rate = (double)result.particleSteps / result.seconds;
+            char instructionsPerStep[32] = "null";
+            if (result.instructions >= 0)
+                snprintf(instructionsPerStep, sizeof(instructionsPerStep), "%.0f",
+                         (double)result.instructions / result.steps);
+
+            fprintf(out, "{\"scene\":\"%s\",\"particles\":%d,\"threads\":%d,\"steps\":%d,\"warmup\":%d,"
+                         "\"dt\":%.9g,\"seed\":%u,\"layout\":\"%s\",\"simd\":\"%s\",\"mode\":\"%s\",\"reorder\":%s,"
+                         "\"adaptive\":%s,\"symmetric\":%s,\"substeps_per_step\":%.3f,\"seconds\":%.6f,\"profiled\":%s,"
+                         "\"ms_per_step\":{\"grid\":%.6f,\"neighbor_list\":%.6f,\"density\":%.6f,\"pressure\":%.6f,"
+                         "\"integrate\":%.6f,\"boundaries\":%.6f},"
+                         "\"particle_steps_per_sec\":%.1f,\"instructions_per_step\":%s,\"peak_rss_kb\":%ld,"
+                         "\"arena_kb\":%zu,\"huge_pages\":%s,\"neighbor_cache_kb\":%zu,"
+                         "\"allocations\":%lld,\"final_particles\":%d,"
+                         "\"checksum\":%.9g}\n",
+                    scene.name, count, options.threads, result.steps, result.warmup, options.dt,
+                    options.seed, layout, simd, options.mode.c_str(), options.reorder ? "true" : "false",
+                    options.adaptive ? "true" : "false", options.symmetric ? "true" : "false", (double)result.substeps / result.steps,
+                    result.seconds, kProfilingEnabled ? "true" : "false",
+                    t.grid * scale, t.neighborList * scale, t.density * scale, t.pressure * scale,
+                    t.integrate * scale, t.boundaries * scale, rate, instructionsPerStep, peakRssKb,
+                    result.arenaBytes / 1024, result.hugePages ? "true" : "false", result.neighborCacheBytes / 1024,
+                    result.allocations, result.finalParticles,
+                    result.checksum);
+            fflush(out);
+
+            fprintf(stderr, "%-13s %9d %6d %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f %12.4g %10.1f\n", scene.name,
+                    count, result.steps, t.grid * scale, t.neighborList * scale, t.density * scale, t.pressure * scale, t.integrate * scale,
+                    t.boundaries * scale, rate, peakRssKb / 1024.0);
+
+            if (options.checkAllocs && result.allocations > 0)
+            {
+                fprintf(stderr, "%s with %d particles: %lld heap allocations in %d steps\n", scene.name, count,
+                        result.allocations, result.steps);
+                failed = true;
+            }
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return failed ? 1 : 0;
+}
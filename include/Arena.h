@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// One block of memory that the solver's per-particle and per-step buffers are
+// carved from. Allocation only bumps an offset and blocks are never freed one by
+// one: when the solver needs more room it maps a new arena, moves its buffers over
+// and drops the old one. On Linux the block is an anonymous mapping, aligned to
+// and advised for transparent huge pages, and pages cost nothing until touched.
+class Arena
+{
+public:
+    static constexpr size_t kAlignment = 64;
+
+    explicit Arena(size_t bytes);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // kAlignment aligned and zeroed, nullptr once the arena is full
+    void *allocate(size_t bytes);
+    static size_t blockBytes(size_t bytes) { return (bytes + kAlignment - 1) / kAlignment * kAlignment; }
+
+    size_t capacity() const { return size; }
+    size_t used() const { return offset; }
+    bool hugePages() const { return huge; }
+
+private:
+    char *base = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    bool mapped = false;
+    bool huge = false;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+// On-disk layout of Particle::saveCheckpoint. The file is the header followed by
+// raw arrays, each starting on a 64-byte boundary at the offset the header's
+// section table gives, so loading is a bounds check and one copy per array out of
+// a read-only mapping. Values are stored in the writer's native byte order;
+// loadCheckpoint rejects files whose magic, version or byte order do not match.
+//
+// Version history:
+//   1  positions, previous positions, velocities, densities, particle ids,
+//      emitters, kill volumes, solver parameters and counters
+
+static constexpr char kCheckpointMagic[8] = {'S', 'P', 'H', 'C', 'K', 'P', 'T', '\0'};
+static constexpr uint32_t kCheckpointVersion = 1;
+static constexpr uint32_t kCheckpointByteOrder = 0x01020304;
+static constexpr uint64_t kCheckpointAlignment = 64;
+
+enum class CheckpointSection
+{
+    PositionX,         // float[particleCount]
+    PositionY,         // float[particleCount]
+    PreviousPositionX, // float[particleCount]
+    PreviousPositionY, // float[particleCount]
+    VelocityX,         // float[particleCount]
+    VelocityY,         // float[particleCount]
+    Density,           // float[particleCount]
+    ParticleId,        // int32[particleCount], id of each index
+    ParticleIndex,     // int32[idCount], index of each id, -1 for removed ids
+    FreeIds,           // int32[freeIdCount]
+    Emitters,          // CheckpointEmitter[emitterCount]
+    KillVolumes,       // CheckpointKillVolume[killVolumeCount]
+    Count
+};
+
+struct CheckpointEmitter
+{
+    float position[2];
+    float velocity[2];
+    float width;
+    float travelled;
+};
+
+struct CheckpointKillVolume
+{
+    float min[2];
+    float max[2];
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerBytes;
+    uint32_t sectionCount;
+    uint64_t fileBytes;
+
+    uint32_t particleCount;
+    uint32_t idCount;
+    uint32_t freeIdCount;
+    uint32_t emitterCount;
+    uint32_t killVolumeCount;
+    int32_t windowWidth;
+    int32_t windowHeight;
+
+    // parameters
+    float radius;
+    float mass;
+    float gravity;
+    float particleSpacing;
+    float smoothingRadius;
+    float targetDensity;
+    float pressureMultiplier;
+    float neighborSkin;
+    float reorderThreshold;
+    float cflNumber;
+    float forceCflNumber;
+    float minTimestep;
+    float maxTimestep;
+    int32_t substeps;
+    int32_t reorderInterval;
+    int32_t pressureFormulation;
+    int32_t neighborsPerParticle;
+    uint8_t useNeighborCache;
+    uint8_t useVerletList;
+    uint8_t useHalfNeighborList;
+    uint8_t useSpatialReorder;
+    uint8_t useAdaptiveTimestep;
+    uint8_t useSimdKernels;
+    uint8_t running;
+    uint8_t reserved;
+
+    // state carried from step to step
+    float maxSpeed;
+    float maxAcceleration;
+    float lastSubstepDt;
+    float gridDisorder;
+    int32_t framesSinceReorder;
+    int32_t lastSubsteps;
+    int64_t substepsTaken;
+    int64_t particlesEmitted;
+    int64_t particlesRemoved;
+
+    uint64_t sectionOffset[(int)CheckpointSection::Count];
+    uint64_t sectionBytes[(int)CheckpointSection::Count];
+};
@@ -3,40 +3,123 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include <iostream>
-#include <SDL3/SDL.h>
-#include <unordered_map>
 #include <functional>
+#include <algorithm>
+#include <memory>
+#include "ThreadPool.h"
+#include "ParticleStorage.h"
+#include "SimdKernels.h"
+#include "Profiler.h"
+
+// how a pair's pressures combine in the pressure force:
+//   SharedPressure  (P_i + P_j) / 2 * (1/rho_i + 1/rho_j), the original form
+//   Symmetric       P_i/rho_i^2 + P_j/rho_j^2, which conserves momentum exactly
+enum class PressureFormulation
+{
+    SharedPressure,
+    Symmetric
+};
+
+// inflow: a row of particles across `width` (centered on position, perpendicular
+// to velocity) is added each time the inflow has moved one particle spacing
+struct ParticleEmitter
+{
+    glm::vec2 position;
+    glm::vec2 velocity;
+    float width = 0.5f;
+    float travelled = 0.0f;
+};
+
+// outflow: particles inside the box are removed
+struct KillVolume
+{
+    glm::vec2 min;
+    glm::vec2 max;
+};
 
 class Particle
 {
 public:
     Particle(int W, int H);
+    Particle(int W, int H, unsigned int seed);
     ~Particle();
 
+    // advances the simulation by dt in `substeps` equal substeps, or with
+    // useAdaptiveTimestep in as many as the CFL limit of stableTimestep() needs
     void update(float dt);
-    void OnEvent(SDL_Event &e);
+    int substeps = 2;
+
+    // CFL limits on the substep: a particle moves at most cflNumber * h per
+    // substep, and the largest acceleration a (pressure plus gravity) limits it
+    // to forceCflNumber * sqrt(h / a); the result is kept in [minTimestep, maxTimestep].
+    // Speed and acceleration come from the previous update.
+    bool useAdaptiveTimestep = false;
+    float cflNumber = 0.4f;
+    float forceCflNumber = 0.25f;
+    float minTimestep = 1.0f / 2000.0f;
+    float maxTimestep = 1.0f / 60.0f;
+    float stableTimestep() const;
+
+    float maxSpeed = 0.0f;
+    float maxAcceleration = 0.0f; // pressure plus gravity
+    float lastSubstepDt = 0.0f;
+    int lastSubsteps = 0;
+    long long substepsTaken = 0;
 
     float &GetRadius() { return radius; }
-    std::vector<glm::vec2> &GetPositions() { return position; }
+    // the tank spans [-half, half] in world units
+    glm::vec2 GetDomainHalfSize() const { return glm::vec2(WINDOW_W, WINDOW_H) / 200.0f; }
+    const Vec2Array &GetPositions() const { return position; }
+    const Vec2Array &GetVelocities() const { return velocite; }
+    // positions before the last update(), in the same particle order as GetPositions()
+    const Vec2Array &GetPreviousPositions() const { return previousPosition; }
+    // writes previous + (current - previous) * alpha for every particle
+    void interpolatePositions(float alpha, glm::vec2 *out);
 
     void MakeGrid();
+    // replaces the scene with numParticles = positions.size() particles at rest
+    void SetParticles(const std::vector<glm::vec2> &positions);
+
+    // incremental changes that keep every other particle's state and id: emitting
+    // appends a particle (doubling the capacity when full) and returns its id,
+    // removing moves the last particle into the freed index. Emitters and kill
+    // volumes are applied at the start of each update()
+    int emitParticle(glm::vec2 pos, glm::vec2 velocity);
+    void removeParticle(int index);
+    std::vector<ParticleEmitter> emitters;
+    std::vector<KillVolume> killVolumes;
+    long long particlesEmitted = 0;
+    long long particlesRemoved = 0;
+
+    // versioned binary checkpoint of the scene, its parameters and the counters
+    // (layout in Checkpoint.h). Loading maps the file and replaces the particles,
+    // ids, emitters and kill volumes; both print the reason and return false on failure
+    bool saveCheckpoint(const char *path) const;
+    bool loadCheckpoint(const char *path);
     float smoothingKernel(float sR, float dst);
+    float smoothingKernelSq(float sr2, float dst2);
     glm::vec2 smoothingKernelGradient(float sr, glm::vec2 vec);
+    glm::vec2 smoothingKernelGradient(float sr, float dst, glm::vec2 dir);
     float calculateDensity(glm::vec2 point);
     float calculateProperty(glm::vec2 point);
     glm::vec2 calculatePressureForce(int particleIndex);
     float convertDensityToPressure(float density);
 
-    void updateDensities(std::vector<glm::vec2> predictedPosition);
+    // both passes only read the positions they are given, any Vec2Array converts
+    void updateDensities(Vec2View samplePositions);
     void recalculateSRConstant();
 
 
-    std::vector<float> pressures;
+    // filled by updatePressures() from the densities, once per substep
+    AlignedBuffer<float> pressures;
+    AlignedBuffer<float> inverseDensities;
+    AlignedBuffer<float> pressureOverDensitySq;
+    PressureFormulation pressureFormulation = PressureFormulation::SharedPressure;
 
     void updatePressures();
 
-    std::vector<float> properties;
-    std::vector<float> densities;
+    AlignedBuffer<float> properties;
+    AlignedBuffer<float> densities;
 
     bool running = false;
     float radius = 1.0f;
@@ -51,27 +134,230 @@ public:
 
     float GRAVITY = 7.23f;
 
-    std::vector<float> speed;
-    std::vector<glm::vec2> predictedPosition;
+    AlignedBuffer<float> speed;
+    Vec2Array predictedPosition;
 
-    void buildSpatialGrid(std::vector<glm::vec2> predictedPos);
-    std::vector<int> getNeighbors(glm::vec2 position);
+    void buildSpatialGrid(Vec2View gridPositions);
+    template <typename Fn>
+    void forEachNeighbor(glm::vec2 samplePoint, Fn &&fn) { forEachNeighbor(samplePoint, smoothingRadius, fn); }
+    template <typename Fn>
+    void forEachNeighbor(glm::vec2 samplePoint, float searchRadius, Fn &&fn);
 
+    // the solver has no windowing dependency; the front end reports the mouse in
+    // world units and applyContinuousMousePressure uses it every substep
+    void setMouseState(glm::vec2 worldPos, bool leftDown, bool rightDown);
     void applyMousePressure(glm::vec2 mousePos, float pressureStrength, float radius);
     void applyContinuousMousePressure();
 
+    // when set, each substep scans the grid once into a CSR neighbor list of
+    // indices and squared distances that the density and force passes reuse
+    // instead of searching the grid themselves. The build is timed as the
+    // NeighborList profiler phase, so it can be weighed against what it saves
+    bool useNeighborCache = false;
+    void buildNeighborList();
+    size_t neighborCacheBytes() const;
+    int neighborPairCount() const { return (int)neighborIndex.size(); }
+
+    // Verlet mode builds the list with smoothingRadius + neighborSkin and keeps it
+    // until some particle has moved more than half the skin since the build
+    bool useVerletList = false;
+    float neighborSkin = 0.04f;
+    int neighborListBuilds = 0;
+    int neighborListSubsteps = 0;
+    // the half list stores each pair once (j > i) and the density and force passes
+    // apply it to both particles; it can be combined with the Verlet skin
+    bool useHalfNeighborList = false;
+    bool usingNeighborList() const { return useNeighborCache || useVerletList || useHalfNeighborList; }
+    float neighborSearchRadius() const { return smoothingRadius + (useVerletList ? neighborSkin : 0.0f); }
+
+    // periodically sorts all per-particle arrays along a Z-order curve of their grid
+    // cell, every reorderInterval frames or as soon as the grid disorder (fraction
+    // of cell-sorted particles not adjacent in memory) exceeds reorderThreshold
+    bool useSpatialReorder = false;
+    int reorderInterval = 120;
+    float reorderThreshold = 0.8f;
+    float gridDisorder = 0.0f;
+    int reorderCount = 0;
+    void reorderParticles();
+
+    // in direct mode, density and pressure force run as vectorized kernels over the
+    // cell runs, using copies of the particle fields sorted in grid order
+    bool useSimdKernels = true;
+    SimdLevel simdLevel = detectSimdLevel();
+    bool usingSimdKernels() const { return useSimdKernels && !usingNeighborList(); }
+    float calculateSimdDensity(glm::vec2 samplePoint);
+    glm::vec2 calculateSimdPressureForce(int particleIndex);
+
+    // per-particle passes are split over a persistent pool; every pass either
+    // gathers or writes only its own particles, so results do not depend on the
+    // count. The half neighbor list is the exception: its sums are added in an
+    // order that depends on the chunk boundaries
+    void setThreadCount(int count) { threadPool.setThreadCount(count); }
+    int getThreadCount() const { return threadPool.getThreadCount(); }
+
+    // the per-particle and per-step buffers are carved from one arena planned for
+    // a particle capacity, so steps make no allocator calls. SetParticles grows the
+    // capacity when a scene needs more. The neighbor list and the half list's
+    // spill queues are planned for neighborsPerParticle pairs per particle and
+    // move to the heap if the list outgrows that
+    void reserveCapacity(int particles);
+    int getCapacity() const { return particleCapacity; }
+    int neighborsPerParticle = 32;
+    size_t arenaBytes() const { return arena ? arena->capacity() : 0; }
+    size_t arenaUsedBytes() const { return arena ? arena->used() : 0; }
+    bool arenaHugePages() const { return arena && arena->hugePages(); }
+
+    // per-phase timings of update(), one profiler frame per call; only filled in
+    // builds with SPH_PROFILE
+    Profiler profiler;
+
+    // particle ids stay attached to a particle across reorders and removals; ids of
+    // removed particles are reused and map to index -1 until then
+    int GetParticleId(int index) const { return particleId[index]; }
+    int GetParticleIndex(int id) const { return particleIndex[id]; }
+    int GetIdCount() const { return (int)particleIndex.size(); }
 
 private:
-    std::vector<glm::vec2> position;
-    std::vector<glm::vec2> velocite;
+    Vec2Array position;
+    Vec2Array previousPosition;
+    Vec2Array velocite;
     int WINDOW_W, WINDOW_H;
 
+    glm::vec2 mouseWorldPos = glm::vec2(0.0f);
+    bool leftMouseDown = false;
+    bool rightMouseDown = false;
+
+    // dense uniform grid over the window, rebuilt by counting sort each substep
     float cellSize;
-    std::unordered_map<int, std::vector<int>> spatialGrid;
+    int gridCols = 0;
+    int gridRows = 0;
+    glm::vec2 gridOrigin;
+    AlignedBuffer<int> cellStart;     // gridCols * gridRows + 1 offsets into cellParticles
+    AlignedBuffer<int> cellParticles; // particle indices ordered by cell
+    AlignedBuffer<int> particleCell;  // cell index of each particle from the last build
+    AlignedBuffer<int> cellHistogram; // per-thread cell counts, then write offsets, during a build
+    AlignedBuffer<int> threadPartial;
+    AlignedBuffer<float> threadMaxSpeedSq;
+    AlignedBuffer<float> threadMaxAccelerationSq;
+
+    // particle fields copied into cellParticles order, padded for full-width loads
+    AlignedBuffer<float> sortedX;
+    AlignedBuffer<float> sortedY;
+    AlignedBuffer<float> sortedPressureTerm; // P or P/rho^2 depending on the formulation
+    AlignedBuffer<float> sortedInverseDensity;
+    void gatherSortedFields();
+    float pressureForceScale(int particleIndex) const;
 
-    int getCellHash(glm::vec2 position);
-    int getCellHash(int x, int y);
+    template <typename Fn>
+    void forEachCellRun(glm::vec2 samplePoint, Fn &&fn);
+
+    void resizeGrid();
+    int getCellX(float x);
+    int getCellY(float y);
+    int getCellIndex(glm::vec2 position);
+
+    // CSR neighbor list, pairs of particle i live in [neighborStart[i], neighborStart[i + 1])
+    AlignedBuffer<int> neighborStart;
+    AlignedBuffer<int> neighborIndex;
+    AlignedBuffer<float> neighborDistanceSq;
+    // pairs found during a build, before they are copied into place: a pool of
+    // fixed-size blocks that each thread chains from threadBlockHead
+    static constexpr int kNeighborBlockPairs = 1024;
+    AlignedBuffer<int> neighborBlockIndex;
+    AlignedBuffer<float> neighborBlockDistanceSq;
+    AlignedBuffer<int> neighborBlockNext;
+    AlignedBuffer<int> threadBlockHead;
+
+    Vec2Array neighborBuildPosition; // predicted positions when the list was built
+    float neighborBuildRadius = 0.0f;
+    bool neighborBuildHalf = false;
+    bool neighborListDirty = true;
+
+    void updateNeighborList();
+    bool neighborListExpired();
+    void refreshNeighborList();
+
+    float calculateCachedDensity(int particleIndex);
+    glm::vec2 calculateCachedPressureForce(int particleIndex);
+
+    // contributions a thread computed for particles in another thread's chunk are
+    // stored in the slot of their pair and added by the owner after the pass. The
+    // slots are listed grouped by (from, to) thread, each thread writing inside its
+    // own range of the list, so every buffer is sized by the pair count
+    AlignedBuffer<int> spillPairs;  // pair slots, grouped by (from, to) thread
+    AlignedBuffer<int> spillStart;  // threads * threads offsets into spillPairs
+    AlignedBuffer<int> spillEnd;
+    AlignedBuffer<float> densitySpillValues;
+    AlignedBuffer<glm::vec2> pressureSpillValues;
+    AlignedBuffer<glm::vec2> pressureSums; // pressure force before pressureForceScale()
+
+    template <typename T, typename Fn>
+    void accumulateHalfPairs(AlignedBuffer<T> &sums, AlignedBuffer<T> &spillValues, T initial, float sign,
+                             Fn &&pairValue);
+    void updateHalfDensities();
+    void updateHalfPressureSums();
+
+    AlignedBuffer<int> particleId;    // id of the particle stored at each index
+    AlignedBuffer<int> particleIndex; // index currently holding each id
+    AlignedBuffer<int> freeIds;       // ids of removed particles, reused first
+    void resetParticleIds();
+    void applyEmittersAndKillVolumes(float dt);
+
+    int framesSinceReorder = 0;
+    AlignedBuffer<unsigned long long> reorderKeys;
+    AlignedBuffer<int> reorderOrder;
+    Vec2Array reorderScratchVec2;
+    AlignedBuffer<float> reorderScratchFloat;
+    AlignedBuffer<int> reorderScratchInt;
+
+    ThreadPool threadPool;
+
+    std::unique_ptr<Arena> arena;
+    int particleCapacity = 0;
 
     float coefKernel;
     float coefGradient;
-};
\ No newline at end of file
+};
+
+// calls fn(begin, end) for each run [begin, end) of cellParticles covering the
+// 3x3 cells around samplePoint; the cells of one grid row are adjacent, so there
+// is one contiguous run per row
+template <typename Fn>
+void Particle::forEachCellRun(glm::vec2 samplePoint, Fn &&fn)
+{
+    int centerCellX = getCellX(samplePoint.x);
+    int centerCellY = getCellY(samplePoint.y);
+
+    int minX = std::max(centerCellX - 1, 0);
+    int maxX = std::min(centerCellX + 1, gridCols - 1);
+    int minY = std::max(centerCellY - 1, 0);
+    int maxY = std::min(centerCellY + 1, gridRows - 1);
+
+    for (int cellY = minY; cellY <= maxY; cellY++)
+    {
+        fn(cellStart[cellY * gridCols + minX], cellStart[cellY * gridCols + maxX + 1]);
+    }
+}
+
+// calls fn(particleIndex, dst2) for every particle whose squared distance dst2 to
+// samplePoint is below searchRadius^2, walking the grid cells in place so a query
+// never allocates. searchRadius must not exceed the cell size of the last grid build
+template <typename Fn>
+void Particle::forEachNeighbor(glm::vec2 samplePoint, float searchRadius, Fn &&fn)
+{
+    float searchRadiusSq = searchRadius * searchRadius;
+
+    forEachCellRun(samplePoint, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int particleIndex = cellParticles[k];
+            glm::vec2 vec = predictedPosition[particleIndex] - samplePoint;
+            float dst2 = glm::dot(vec, vec);
+            if (dst2 < searchRadiusSq)
+            {
+                fn(particleIndex, dst2);
+            }
+        }
+    });
+}
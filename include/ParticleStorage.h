@@ -0,0 +1,300 @@
+#pragma once
+
+#include "Arena.h"
+#include <glm/glm.hpp>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <new>
+
+// Storage for per-particle vec2 state. Passes go through Vec2Array's accessors
+// (operator[] to read, set/add to write, x/y for single components) so the same
+// code compiles for both layouts:
+//   default          interleaved x/y pairs (AoS), uploadable to GL as is
+//   SPH_SOA_LAYOUT   separate x[] and y[] float lanes (SoA)
+// Buffers are 64-byte aligned and their capacity is padded to kSimdLanes floats,
+// with the padding zeroed, so vector loops can run over whole lanes. A buffer
+// rehomed into an Arena takes its blocks from there until the arena is full, and
+// from the heap after that.
+// Vec2View is the non-owning, read-only counterpart that solver passes take
+// instead of an array, so handing positions to a pass never copies them.
+
+constexpr int kSimdAlignment = 64;
+constexpr int kSimdLanes = kSimdAlignment / sizeof(float);
+static_assert(kSimdAlignment <= Arena::kAlignment, "arena blocks must be SIMD aligned");
+
+// minimal aligned vector for trivially copyable element types
+template <typename T>
+class AlignedBuffer
+{
+public:
+    AlignedBuffer() = default;
+    AlignedBuffer(const AlignedBuffer &other) { *this = other; }
+    AlignedBuffer(AlignedBuffer &&other) noexcept { swap(other); }
+    ~AlignedBuffer() { release(); }
+
+    AlignedBuffer &operator=(const AlignedBuffer &other)
+    {
+        if (this != &other)
+        {
+            resize(other.count);
+            if (count > 0)
+                std::memcpy(values, other.values, count * sizeof(T));
+        }
+        return *this;
+    }
+
+    AlignedBuffer &operator=(AlignedBuffer &&other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(AlignedBuffer &other) noexcept
+    {
+        std::swap(values, other.values);
+        std::swap(count, other.count);
+        std::swap(allocated, other.allocated);
+        std::swap(arenaBlock, other.arenaBlock);
+    }
+
+    T &operator[](size_t i) { return values[i]; }
+    const T &operator[](size_t i) const { return values[i]; }
+    T *data() { return values; }
+    const T *data() const { return values; }
+    T *begin() { return values; }
+    T *end() { return values + count; }
+    const T *begin() const { return values; }
+    const T *end() const { return values + count; }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return allocated; }
+
+    void clear() { count = 0; }
+
+    void assign(size_t n, const T &value)
+    {
+        resize(n);
+        std::fill(values, values + n, value);
+    }
+
+    void reserve(size_t n)
+    {
+        if (n > allocated)
+            reallocate(n);
+    }
+
+    // moves the contents into a block for at least n elements taken from owner,
+    // which later growth also tries first
+    void rehome(Arena *owner, size_t n)
+    {
+        arena = owner;
+        reallocate(std::max(n, count));
+    }
+
+    // arena bytes rehome() takes for n elements
+    static size_t blockBytes(size_t n) { return Arena::blockBytes(n * sizeof(T)); }
+
+    void resize(size_t n, const T &fill = T())
+    {
+        if (n > allocated)
+            reserve(std::max(n, allocated * 2));
+        for (size_t i = count; i < n; i++)
+            values[i] = fill;
+        count = n;
+    }
+
+    void push_back(const T &value)
+    {
+        if (count == allocated)
+            reserve(allocated ? allocated * 2 : kSimdLanes);
+        values[count++] = value;
+    }
+
+private:
+    void reallocate(size_t n)
+    {
+        // round up to whole SIMD lanes so the tail can be processed unmasked
+        size_t bytes = blockBytes(n);
+        size_t newCapacity = bytes / sizeof(T);
+
+        // arena blocks come zeroed, so only heap blocks need the padding cleared
+        T *grown = static_cast<T *>(arena ? arena->allocate(bytes) : nullptr);
+        bool grownInArena = grown != nullptr;
+        if (!grownInArena)
+        {
+            grown = static_cast<T *>(::operator new(bytes, std::align_val_t(kSimdAlignment)));
+            std::memset(static_cast<void *>(grown), 0, bytes);
+        }
+        if (count > 0)
+            std::memcpy(static_cast<void *>(grown), values, count * sizeof(T));
+
+        release();
+        values = grown;
+        allocated = newCapacity;
+        arenaBlock = grownInArena;
+    }
+
+    // arena blocks go away with their arena
+    void release()
+    {
+        if (values && !arenaBlock)
+            ::operator delete(values, std::align_val_t(kSimdAlignment));
+    }
+
+    T *values = nullptr;
+    size_t count = 0;
+    size_t allocated = 0;
+    Arena *arena = nullptr;
+    bool arenaBlock = false;
+};
+
+#ifdef SPH_SOA_LAYOUT
+
+class Vec2Array;
+
+class Vec2View
+{
+public:
+    Vec2View(const float *xs, const float *ys, size_t count) : xs(xs), ys(ys), count(count) {}
+    Vec2View(const Vec2Array &array);
+
+    glm::vec2 operator[](int i) const { return {xs[i], ys[i]}; }
+    const float *xData() const { return xs; }
+    const float *yData() const { return ys; }
+    size_t size() const { return count; }
+
+private:
+    const float *xs;
+    const float *ys;
+    size_t count;
+};
+
+class Vec2Array
+{
+public:
+    glm::vec2 operator[](int i) const { return {xs[i], ys[i]}; }
+    void set(int i, glm::vec2 v)
+    {
+        xs[i] = v.x;
+        ys[i] = v.y;
+    }
+    void add(int i, glm::vec2 v)
+    {
+        xs[i] += v.x;
+        ys[i] += v.y;
+    }
+    float &x(int i) { return xs[i]; }
+    float &y(int i) { return ys[i]; }
+
+    float *xData() { return xs.data(); }
+    float *yData() { return ys.data(); }
+    const float *xData() const { return xs.data(); }
+    const float *yData() const { return ys.data(); }
+
+    size_t size() const { return xs.size(); }
+    size_t capacity() const { return xs.capacity(); }
+    size_t bytes() const { return 2 * xs.capacity() * sizeof(float); }
+    void clear()
+    {
+        xs.clear();
+        ys.clear();
+    }
+    void resize(size_t n)
+    {
+        xs.resize(n);
+        ys.resize(n);
+    }
+    void push_back(glm::vec2 v)
+    {
+        xs.push_back(v.x);
+        ys.push_back(v.y);
+    }
+    void rehome(Arena *arena, size_t n)
+    {
+        xs.rehome(arena, n);
+        ys.rehome(arena, n);
+    }
+    static size_t blockBytes(size_t n) { return 2 * AlignedBuffer<float>::blockBytes(n); }
+    void swap(Vec2Array &other) noexcept
+    {
+        xs.swap(other.xs);
+        ys.swap(other.ys);
+    }
+
+    // returns the positions as interleaved pairs, packing them into scratch
+    const glm::vec2 *interleaved(AlignedBuffer<glm::vec2> &scratch) const
+    {
+        scratch.resize(size());
+        copyInterleaved(scratch.data(), (int)size());
+        return scratch.data();
+    }
+    void copyInterleaved(glm::vec2 *dst, int n) const
+    {
+        for (int i = 0; i < n; i++)
+            dst[i] = {xs[i], ys[i]};
+    }
+
+private:
+    AlignedBuffer<float> xs;
+    AlignedBuffer<float> ys;
+};
+
+inline Vec2View::Vec2View(const Vec2Array &array) : Vec2View(array.xData(), array.yData(), array.size()) {}
+
+#else
+
+class Vec2Array;
+
+class Vec2View
+{
+public:
+    Vec2View(const glm::vec2 *values, size_t count) : values(values), count(count) {}
+    Vec2View(const Vec2Array &array);
+
+    glm::vec2 operator[](int i) const { return values[i]; }
+    const glm::vec2 *data() const { return values; }
+    size_t size() const { return count; }
+
+private:
+    const glm::vec2 *values;
+    size_t count;
+};
+
+class Vec2Array
+{
+public:
+    glm::vec2 operator[](int i) const { return values[i]; }
+    void set(int i, glm::vec2 v) { values[i] = v; }
+    void add(int i, glm::vec2 v) { values[i] += v; }
+    float &x(int i) { return values[i].x; }
+    float &y(int i) { return values[i].y; }
+
+    glm::vec2 *data() { return values.data(); }
+    const glm::vec2 *data() const { return values.data(); }
+
+    size_t size() const { return values.size(); }
+    size_t capacity() const { return values.capacity(); }
+    size_t bytes() const { return values.capacity() * sizeof(glm::vec2); }
+    void clear() { values.clear(); }
+    void resize(size_t n) { values.resize(n); }
+    void push_back(glm::vec2 v) { values.push_back(v); }
+    void rehome(Arena *arena, size_t n) { values.rehome(arena, n); }
+    static size_t blockBytes(size_t n) { return AlignedBuffer<glm::vec2>::blockBytes(n); }
+    void swap(Vec2Array &other) noexcept { values.swap(other.values); }
+
+    // already interleaved, scratch is not touched
+    const glm::vec2 *interleaved(AlignedBuffer<glm::vec2> &) const { return values.data(); }
+    void copyInterleaved(glm::vec2 *dst, int n) const
+    {
+        std::memcpy(static_cast<void *>(dst), values.data(), n * sizeof(glm::vec2));
+    }
+
+private:
+    AlignedBuffer<glm::vec2> values;
+};
+
+inline Vec2View::Vec2View(const Vec2Array &array) : Vec2View(array.data(), array.size()) {}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+
+// Scoped wall-clock timers for the hot phases of a frame. SPH_PROFILE_SCOPE and
+// SPH_PROFILE_FRAME expand to nothing unless the build defines SPH_PROFILE, so a
+// build without it pays no clock reads at all; a Profiler then just stays empty.
+
+enum class ProfilePhase
+{
+    // Particle::update
+    Grid,         // emitters and kill volumes, reorder, grid or neighbor list build, sorted field copies
+    NeighborList, // the neighbor list update alone, also counted in Grid
+    Density,      // densities and pressures
+    Pressure,     // mouse interaction and pressure forces
+    Integrate,    // predicted positions and position advance
+    Boundaries,   // gravity, speed and wall collisions
+    Step,         // the whole update
+    // Game
+    Colors,
+    Upload,
+    Draw,
+    Gui,
+    Swap,
+    Count
+};
+
+const char *profilePhaseName(ProfilePhase phase);
+
+// milliseconds over the frames kept in the history, total and samples over all frames
+struct PhaseStats
+{
+    float last = 0.0f;
+    float average = 0.0f;
+    float p50 = 0.0f;
+    float p95 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+    double total = 0.0; // seconds
+    long long frames = 0;
+};
+
+class Profiler
+{
+public:
+    static constexpr int kHistory = 240;
+    static constexpr int kPhaseCount = (int)ProfilePhase::Count;
+
+    // adds to the phase's time in the current frame; a phase can be entered several
+    // times per frame (once per substep)
+    void add(ProfilePhase phase, double seconds)
+    {
+        Track &track = tracks[(int)phase];
+        track.current += seconds;
+        track.touched = true;
+    }
+
+    // moves the current frame of every phase that ran into its history
+    void endFrame();
+    void reset();
+
+    PhaseStats stats(ProfilePhase phase) const;
+    bool hasSamples(ProfilePhase phase) const { return tracks[(int)phase].frames > 0; }
+
+private:
+    struct Track
+    {
+        double current = 0.0;
+        bool touched = false;
+        float history[kHistory] = {};
+        int next = 0;
+        long long frames = 0;
+        double total = 0.0;
+    };
+
+    Track tracks[kPhaseCount];
+};
+
+class ScopedPhaseTimer
+{
+public:
+    ScopedPhaseTimer(Profiler &profiler, ProfilePhase phase)
+        : profiler(profiler), phase(phase), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedPhaseTimer()
+    {
+        profiler.add(phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    ScopedPhaseTimer(const ScopedPhaseTimer &) = delete;
+    ScopedPhaseTimer &operator=(const ScopedPhaseTimer &) = delete;
+
+private:
+    Profiler &profiler;
+    ProfilePhase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef SPH_PROFILE
+constexpr bool kProfilingEnabled = true;
+#define SPH_PROFILE_JOIN2(a, b) a##b
+#define SPH_PROFILE_JOIN(a, b) SPH_PROFILE_JOIN2(a, b)
+#define SPH_PROFILE_SCOPE(profiler, phase) \
+    ScopedPhaseTimer SPH_PROFILE_JOIN(phaseTimer, __LINE__)((profiler), ProfilePhase::phase)
+#define SPH_PROFILE_FRAME(profiler) (profiler).endFrame()
+#else
+constexpr bool kProfilingEnabled = false;
+#define SPH_PROFILE_SCOPE(profiler, phase) ((void)0)
+#define SPH_PROFILE_FRAME(profiler) ((void)0)
+#endif
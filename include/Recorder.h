@@ -0,0 +1,177 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Particle;
+
+// Recording container written by FrameRecorder and read by FrameReader:
+//
+//   RecordingHeader
+//   one chunk per recorded frame: RecordingChunk, then payloadBytes of streams
+//   RecordingIndexEntry[frameCount], the file offset of every chunk
+//   RecordingTrailer
+//
+// A frame holds kRecordingStreams streams of `particles` values each, in this
+// order: particle id, x, y, vx, vy, density. Floats are either stored raw or,
+// with kRecordingQuantized, as 16-bit fixed point over [low, high] of their
+// stream (the domain for positions, the frame's own range otherwise). With
+// kRecordingCompressed every value goes through a cheap transform (delta for
+// ids and fixed point, XOR with the previous value for raw floats) and is then
+// written as a LEB128 varint, so values close to their neighbor take one or two
+// bytes. Without it values are stored at their full width. Chunks start with a
+// magic number and their size, so a file whose writer died before the index
+// can still be read front to back.
+
+static constexpr char kRecordingMagic[8] = {'S', 'P', 'H', 'R', 'E', 'C', '\0', '\0'};
+static constexpr uint32_t kRecordingVersion = 1;
+static constexpr uint32_t kRecordingChunkMagic = 0x4b4e4843; // "CHNK"
+static constexpr uint32_t kRecordingQuantized = 1;
+static constexpr uint32_t kRecordingCompressed = 2;
+static constexpr int kRecordingStreams = 6;
+
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t every; // solver steps between recorded frames
+    uint32_t headerBytes;
+    float domainMin[2];
+    float domainMax[2];
+};
+
+struct RecordingChunk
+{
+    uint32_t magic;
+    uint32_t particles;
+    int64_t step;
+    uint64_t payloadBytes;
+    float low[kRecordingStreams]; // quantization range of each stream, unused for ids
+    float high[kRecordingStreams];
+};
+
+struct RecordingIndexEntry
+{
+    int64_t step;
+    uint64_t offset; // of the frame's RecordingChunk
+};
+
+struct RecordingTrailer
+{
+    uint64_t indexOffset;
+    uint64_t frameCount;
+    char magic[8];
+};
+
+// one recorded step, with every field in its own array
+struct RecordedFrame
+{
+    int64_t step = 0;
+    std::vector<int32_t> ids;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> density;
+
+    int particles() const { return (int)ids.size(); }
+    void resize(int n);
+};
+
+struct RecorderOptions
+{
+    int every = 1;         // record every Nth captured step
+    bool quantize = false; // 16-bit fixed point instead of raw floats
+    bool compress = true;
+    int queueFrames = 8;   // frames in flight between the solver and the writer
+    bool blockWhenFull = false; // wait for the writer instead of dropping a frame
+};
+
+// Writes every options.every-th step to disk on a thread of its own. capture()
+// only copies the particle fields into a frame taken from a fixed pool and hands
+// it to the writer thread, which encodes and writes it. When all pool frames are
+// waiting to be written, capture() drops the step so the solver never waits on
+// the disk, and framesDropped counts it; with options.blockWhenFull it waits for
+// a frame instead and stalls counts those waits. Errors are reported once on
+// stderr and turn further captures into no-ops.
+class FrameRecorder
+{
+public:
+    FrameRecorder() = default;
+    ~FrameRecorder() { close(); }
+
+    FrameRecorder(const FrameRecorder &) = delete;
+    FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+    bool open(const char *path, const Particle &p, const RecorderOptions &options);
+    // call once per solver step; steps that are not multiples of `every` return at once
+    void capture(const Particle &p, long long step);
+    // writes the queued frames and the frame index, then closes the file
+    bool close();
+
+    bool isOpen() const { return file != nullptr; }
+    long long framesRecorded() const { return recorded; }
+    long long framesDropped() const { return droppedCount; }
+    long long stalls() const { return stallCount; }
+    // raw size of the recorded fields against the bytes written, for the compression ratio
+    unsigned long long rawBytes() const;
+    unsigned long long writtenBytes() const;
+
+private:
+    void writerLoop();
+    bool writeFrame(const RecordedFrame &frame);
+
+    FILE *file = nullptr;
+    RecorderOptions options;
+    RecordingHeader header;
+    long long recorded = 0;
+    long long droppedCount = 0;
+    long long stallCount = 0;
+
+    std::thread writer;
+    mutable std::mutex mutex;
+    std::condition_variable frameReady; // writer waits for queued frames
+    std::condition_variable frameFree;  // capture waits for a pool frame
+    std::vector<RecordedFrame> pool;
+    std::vector<RecordedFrame *> freeFrames;
+    std::deque<RecordedFrame *> queued;
+    bool closing = false;
+    bool failed = false;
+
+    // writer thread only, apart from the byte counts read under the mutex
+    std::vector<uint8_t> payload;
+    std::vector<RecordingIndexEntry> index;
+    unsigned long long raw = 0;
+    unsigned long long written = 0;
+};
+
+// Random access to a recording: the frame index is read once, then any frame can
+// be decoded by its position in the file. A recording without an index is
+// scanned chunk by chunk instead, up to its last complete frame.
+class FrameReader
+{
+public:
+    ~FrameReader();
+
+    bool open(const char *path);
+    int frameCount() const { return (int)index.size(); }
+    long long frameStep(int frame) const { return index[frame].step; }
+    bool readFrame(int frame, RecordedFrame &out);
+
+    const RecordingHeader &getHeader() const { return header; }
+
+private:
+    void scanChunks(uint64_t fileBytes);
+
+    FILE *file = nullptr;
+    RecordingHeader header;
+    std::vector<RecordingIndexEntry> index;
+    uint64_t chunksEnd = 0; // no chunk reaches past this offset
+    std::vector<uint8_t> payload;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Vectorized inner loops for the density and pressure passes. Each kernel walks one
+// contiguous run of cell-sorted candidates (8 or 16 per iteration on AVX2/AVX-512)
+// and masks out-of-range lanes instead of branching. Candidate arrays must stay
+// readable kSimdLanes floats past the end of the run.
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE4,
+    AVX2,
+    AVX512
+};
+
+// sum over the run of (sr2 - r2)^3 for every candidate with r2 < cutoff2
+using DensitySumFn = float (*)(const float *xs, const float *ys, int count,
+                               float px, float py, float sr2, float cutoff2);
+
+// sum over the run of (t + ts_j) * (s + ss_j) * (sr - r)^2 / r * (p - p_j) for every
+// candidate with 0 < r < sr, where t and s are precomputed per-particle terms
+// (P and 1/rho for the shared-pressure form); with ss == nullptr the second factor
+// is left out, which is the symmetric form with t = P/rho^2
+using PressureSumFn = glm::vec2 (*)(const float *xs, const float *ys,
+                                    const float *ts, const float *ss, int count,
+                                    float px, float py, float t, float s, float sr);
+
+struct SimdKernels
+{
+    SimdLevel level;
+    DensitySumFn densitySum;
+    PressureSumFn pressureSum;
+};
+
+// best level supported by the CPU this process runs on
+SimdLevel detectSimdLevel();
+const char *simdLevelName(SimdLevel level);
+
+// kernels for the requested level, lowered to what the CPU supports
+SimdKernels getSimdKernels(SimdLevel level);
+
+// largest relative difference between the kernels of a level and the scalar ones
+// over random candidate runs
+float checkSimdKernels(SimdLevel level);
@@ -0,0 +1,114 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include "Particle.h"
+#include "Recorder.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+// counters and readouts of the solver, as of the snapshot they came with
+struct SolverStats
+{
+  int numParticles = 0;
+  int capacity = 0;
+  long long particlesEmitted = 0;
+  long long particlesRemoved = 0;
+  int neighborListBuilds = 0;
+  int neighborListSubsteps = 0;
+  size_t neighborCacheBytes = 0;
+  int neighborPairCount = 0;
+  float gridDisorder = 0.0f;
+  int reorderCount = 0;
+  size_t arenaBytes = 0;
+  size_t arenaUsedBytes = 0;
+  bool arenaHugePages = false;
+  float lastSubstepDt = 0.0f;
+  int lastSubsteps = 0;
+  float maxSpeed = 0.0f;
+  float maxAcceleration = 0.0f;
+  int stepsLastBatch = 0; // steps between the previous snapshot and this one
+  int droppedSteps = 0;
+  bool recording = false;
+  long long framesRecorded = 0;
+  long long framesDropped = 0;
+  long long recorderStalls = 0;
+};
+
+// everything the render thread needs from the solver to draw one frame
+struct SolverSnapshot
+{
+  int count = 0;
+  AlignedBuffer<glm::vec2> positions;         // after the last step
+  AlignedBuffer<glm::vec2> previousPositions; // before it
+  AlignedBuffer<float> speed;
+  AlignedBuffer<float> densities;
+  AlignedBuffer<float> pressures;
+
+  // the solver's clock was `accumulator` seconds past its last step at `published`,
+  // and the next step is stepDt long; the renderer interpolates from that
+  bool running = false;
+  float accumulator = 0.0f;
+  float stepDt = 1.0f;
+  std::chrono::steady_clock::time_point published;
+
+  SolverStats stats;
+  Profiler profiler;
+};
+
+// Runs a Particle on its own thread so solving overlaps rendering. The solver
+// advances in real time like Game::update used to: steps of 1 / simRate (or the
+// CFL step in adaptive mode), at most maxStepsPerBatch at once, and sleeps until
+// the next step is due. After every batch it publishes a snapshot through a
+// triple buffer. Between start() and stop() the Particle belongs to the solver
+// thread, and the render thread changes it only through submit().
+class SimulationThread
+{
+public:
+  using Command = std::function<void(Particle &)>;
+
+  ~SimulationThread() { stop(); }
+
+  void start(Particle *particle);
+  // finishes an active recording unless keepRecording is set, in which case the
+  // next start() goes on writing to it
+  void stop(bool keepRecording = false);
+
+  // render thread: runs command on the solver thread before its next batch;
+  // commands run in the order they were submitted
+  void submit(Command command);
+  // render thread: the newest published snapshot
+  const SolverSnapshot &latest();
+
+  // render thread: record the solver's steps to path from its next batch on, or
+  // stop and finish the file; both go through the command queue
+  void startRecording(const std::string &path, const RecorderOptions &options);
+  void stopRecording();
+
+  std::atomic<float> simRate{120.0f};
+  std::atomic<int> maxStepsPerBatch{8};
+
+private:
+  static const int kQueueCapacity = 256;
+
+  void run();
+  void publish(float stepDt, std::chrono::steady_clock::time_point now, int steps);
+
+  Particle *p = nullptr;
+  std::thread thread;
+  std::atomic<bool> quit{false};
+  SpscQueue<Command, kQueueCapacity> commands;
+  TripleBuffer<SolverSnapshot> snapshots;
+
+  // solver thread only
+  float accumulator = 0.0f;
+  int droppedSteps = 0;
+  long long stepCount = 0;
+  std::unique_ptr<FrameRecorder> recorder;
+};
+
+#endif // !SIMULATION_THREAD_H
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded queue between exactly one producer thread and one consumer thread.
+// Neither side locks or waits: push fails when the queue is full and pop fails
+// when it is empty. Indices only grow, so full and empty are told apart without
+// giving up a slot.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // producer thread only
+    bool push(T value)
+    {
+        size_t tail = writeIndex.load(std::memory_order_relaxed);
+        if (tail - readIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[tail & (Capacity - 1)] = std::move(value);
+        writeIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only
+    bool pop(T &value)
+    {
+        size_t head = readIndex.load(std::memory_order_relaxed);
+        if (head == writeIndex.load(std::memory_order_acquire))
+            return false;
+        T &slot = slots[head & (Capacity - 1)];
+        value = std::move(slot);
+        slot = T(); // drop whatever the moved-from slot still holds
+        readIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T slots[Capacity];
+    // on separate cache lines so the two threads do not invalidate each other
+    alignas(64) std::atomic<size_t> writeIndex{0};
+    alignas(64) std::atomic<size_t> readIndex{0};
+};
@@ -0,0 +1,57 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+// How per-frame vertex data reaches the GPU without the driver stalling on the
+// draw that read the previous frame's data:
+//   Persistent  GL 4.4 immutable storage mapped once, kRegions copies used in
+//               turn, each guarded by a fence set after the draw that read it
+//   Orphan      GL 3.3 fallback, the buffer gets fresh storage every frame
+//               and that storage is mapped for writing
+// Either way the caller writes straight into the mapped memory.
+enum class UploadMode
+{
+  Persistent,
+  Orphan
+};
+
+const char *uploadModeName(UploadMode mode);
+
+class StreamBuffer
+{
+public:
+  static const int kRegions = 3;
+
+  // Persistent needs GL 4.4; without it the buffer quietly uses Orphan
+  void create(GLsizeiptr elementSize, int capacity, UploadMode mode);
+  void destroy();
+
+  // write-only memory for count elements of the next region, null when count is
+  // 0; waits only if the GPU is still drawing from that region
+  void *map(int count);
+  void unmap();
+  // after the draw that reads the region mapped last
+  void fence();
+
+  GLuint buffer() const { return id; }
+  UploadMode mode() const { return uploadMode; }
+  int capacity() const { return regionCapacity; }
+  // first element of the region mapped last, for glDrawArrays
+  int firstElement() const { return uploadMode == UploadMode::Persistent ? region * regionCapacity : 0; }
+  // maps that found their region still in use by the GPU
+  long long stalls() const { return stallCount; }
+
+private:
+  GLuint id = 0;
+  UploadMode uploadMode = UploadMode::Orphan;
+  GLsizeiptr elementBytes = 0;
+  int regionCapacity = 0;
+  int region = 0;
+  char *persistent = nullptr;
+  bool orphanMapped = false;
+  GLsync fences[kRegions] = {};
+  long long stallCount = 0;
+};
+
+#endif // !STREAM_BUFFER_H
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+
+// Persistent worker pool for the per-particle passes. Workers are created once
+// and sleep between jobs, so dispatching a pass never creates threads or allocates.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threadCount = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void setThreadCount(int count);
+    int getThreadCount() const { return threadCount; }
+
+    // splits [0, count) into one contiguous chunk per thread (static schedule) and
+    // calls fn(begin, end, threadIndex) for each; the calling thread runs chunk 0.
+    // Chunk boundaries depend only on count and the thread count, and fn runs once
+    // per thread even when its chunk is empty, so per-thread slots are always written.
+    template <typename Fn>
+    void parallelFor(int count, Fn &&fn);
+
+    int chunkBegin(int count, int chunk) const { return (int)((long long)count * chunk / threadCount); }
+    // the chunk, and so the thread, that index falls in
+    int chunkOf(int count, int index) const { return (int)((((long long)index + 1) * threadCount - 1) / count); }
+
+private:
+    using Task = void (*)(void *context, int begin, int end, int threadIndex);
+
+    void run(int count, Task task, void *context);
+    void workerLoop(int threadIndex, unsigned int startGeneration);
+    void startWorkers();
+    void stopWorkers();
+
+    int threadCount = 1;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    Task task = nullptr;
+    void *taskContext = nullptr;
+    int taskCount = 0;
+    unsigned int generation = 0;
+    int pendingWorkers = 0;
+    bool stopping = false;
+};
+
+template <typename Fn>
+void ThreadPool::parallelFor(int count, Fn &&fn)
+{
+    using Callable = typename std::remove_reference<Fn>::type;
+    Task trampoline = [](void *context, int begin, int end, int threadIndex)
+    {
+        (*static_cast<Callable *>(context))(begin, end, threadIndex);
+    };
+    run(count, trampoline, (void *)&fn);
+}
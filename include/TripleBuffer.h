@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+// Hands the newest of a stream of values from one writer thread to one reader
+// thread without locks. The writer fills back() and publishes it, the reader
+// switches to the newest published slot and keeps reading front() until it
+// switches again. Values the reader never got to are overwritten, and neither
+// side ever waits for the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // writer thread only
+    T &back() { return slots[backIndex]; }
+    void publish() { backIndex = shared.exchange(backIndex | kFresh, std::memory_order_acq_rel) & kIndexMask; }
+
+    // reader thread only; false when nothing was published since the last switch
+    bool update()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & kFresh))
+            return false;
+        frontIndex = shared.exchange(frontIndex, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr int kIndexMask = 3;
+    static constexpr int kFresh = 4; // the shared slot was published and not read yet
+
+    T slots[3];
+    int backIndex = 0;
+    alignas(64) std::atomic<int> shared{1};
+    alignas(64) int frontIndex = 2;
+};
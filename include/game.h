@@ -6,28 +6,104 @@
 #include <SDL3/SDL_video.h>
 #include "shader.h"
 #include "Particle.h"
+#include "Profiler.h"
+#include "StreamBuffer.h"
+#include "SimulationThread.h"
 #include "imgui.h"
 #include "backends/imgui_impl_sdl3.h"
 #include "backends/imgui_impl_opengl3.h"
 
+// particle field the colormap is applied to
+enum class ColorField
+{
+  Speed,
+  Density,
+  Pressure
+};
+
+// the solver settings the Debug window edits. While the solver thread runs the
+// window works on this copy and queues it for the solver whenever it changes
+struct SolverControls
+{
+  float gravity;
+  float radius;
+  float mass;
+  float alpha;
+  float particleSpacing;
+  float smoothingRadius;
+  float targetDensity;
+  float pressureMultiplier;
+  bool useSimdKernels;
+  SimdLevel simdLevel;
+  PressureFormulation pressureFormulation;
+  bool useNeighborCache;
+  bool useVerletList;
+  bool useHalfNeighborList;
+  float neighborSkin;
+  bool useSpatialReorder;
+  int reorderInterval;
+  float reorderThreshold;
+  bool useAdaptiveTimestep;
+  float cflNumber;
+  float forceCflNumber;
+  int substeps;
+  bool running;
+
+  static SolverControls from(const Particle &p);
+  void applyTo(Particle &p) const;
+  bool usingNeighborList() const { return useNeighborCache || useVerletList || useHalfNeighborList; }
+};
+
 class Game
 {
 public:
   Game();
 
-  bool init(const char *title, int WINDOW_W, int WINDOW_H);
+  bool init(const char *title, int WINDOW_W, int WINDOW_H, int threads = 0);
   void handleEvent();
-  void update(float dt);
+  void handleMouseEvent(SDL_Event &e);
+  void update(float frameDt);
   void render();
   bool running() { return isRunning; }
   void clear();
 
-  void recreateBuffers();
+  void growBuffers(int capacity);
 
   void ImguiInit();
   void ImguiRender();
+  void ImguiTimings();
 
-  std::vector<glm::vec3> colors;
+  // colors, upload, draw, gui and swap of each frame; the solver phases come with
+  // the latest snapshot
+  const Profiler &GetFrameProfiler() const { return frameProfiler; }
+  const Profiler &GetSolverProfiler() const { return snapshot->profiler; }
+
+  // values at colorRange.x and colorRange.y map to the two ends of the colormap
+  ColorField colorField = ColorField::Speed;
+  glm::vec2 colorRange = glm::vec2(0.0f, 5.0f);
+  glm::vec2 defaultColorRange(ColorField field) const;
+
+  // written and read by the Debug window's checkpoint buttons. A load restarts
+  // the solver thread, so the button only queues it for the start of the next
+  // frame, before that frame takes its snapshot
+  std::string checkpointPath = "sph.ckpt";
+  bool checkpointLoadPending = false;
+  void loadCheckpoint();
+
+  // the Debug window's record checkbox writes the solver's steps here.
+  // recordingNote says why a recording ended without the checkbox
+  std::string recordingPath = "sph.rec";
+  RecorderOptions recorderOptions;
+  std::string recordingNote;
+
+  // set before init; falls back to Orphan when the context is older than GL 4.4
+  UploadMode uploadMode = UploadMode::Persistent;
+
+  // the solver runs on its own thread in steps of 1 / simRate, or of its CFL step
+  // when adaptive dt is on, at most maxStepsPerFrame at once (see SimulationThread).
+  // Each frame draws the newest snapshot, interpolated between its last two steps
+  float simRate = 120.0f;
+  int maxStepsPerFrame = 8;
 
   void handleCameraControls(float dt);
   glm::mat4 getViewMatrix() const;
@@ -48,8 +124,27 @@ private:
   int frameCount;
   float fps;
 
+  // owned by the solver thread between init and clear; the render thread reaches
+  // it through simulation.submit()
   Particle *p;
-  int previousNumParticles;
+  SimulationThread simulation;
+  const SolverSnapshot *snapshot = nullptr;
+  SolverControls controls;
+  int sceneParticles = 0; // size of the scene the numParticles slider rebuilds
+  bool pipes = false;
+  void submitControls();
+  int bufferCapacity = 0; // particles the vertex buffers have room for
+  // interpolated positions and the colorField scalars, written straight into
+  // mapped GPU memory
+  StreamBuffer positionStream;
+  StreamBuffer scalarStream;
+  GLuint colormapTexture = 0;
+  const AlignedBuffer<float> &colorFieldValues() const;
+  bool leftMouseDown;
+  bool rightMouseDown;
+  int threadCount;
+
+  Profiler frameProfiler;
 };
 
 #endif // !GAME_H
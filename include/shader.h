@@ -15,6 +15,7 @@ public:
   void use() const;
   void destroy() const;
 
+  void setInt(const std::string &name, int value) const;
   void setFloat(const std::string &name, float value) const;
   void setVec2(const std::string &name, const glm::vec2 &value) const;
   void setScale(const std::string &name,  float value) const;
@@ -1,12 +1,14 @@
 #version 330 core
 layout(location = 0) in vec2 aPos;
-layout(location = 1) in vec3 aColor; // 🔹 add color attribute
+layout(location = 1) in float aScalar; // speed, density or pressure of the particle
 
 out vec3 fColor; // pass to fragment shader
 
 uniform vec2 screenSize;
 uniform float pointSize;
 uniform float worldScale;
+uniform sampler1D colormap;
+uniform vec2 colorRange; // scalar values mapped to the two ends of the colormap
 
 void main()
 {
@@ -17,5 +19,6 @@ void main()
     gl_Position = vec4(ndc, 0.0, 1.0);
     gl_PointSize = pointSize * worldScale;
 
-    fColor = aColor; // 🔹 pass color to fragment
+    float t = clamp((aScalar - colorRange.x) / max(colorRange.y - colorRange.x, 1e-6), 0.0, 1.0);
+    fColor = texture(colormap, t).rgb;
 }
@@ -0,0 +1,85 @@
+#include "Arena.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define SPH_ARENA_MMAP
+#endif
+
+static constexpr size_t kHugePageSize = 2 << 20;
+
+// madvise accepts MADV_HUGEPAGE even when the system has huge pages turned off
+static bool transparentHugePagesEnabled()
+{
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string setting;
+    std::getline(file, setting);
+    return file && setting.find("[never]") == std::string::npos;
+}
+
+Arena::Arena(size_t bytes)
+{
+    // whole huge pages, so the tail of the block can be backed by one as well
+    size = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    if (size == 0)
+        return;
+
+#ifdef SPH_ARENA_MMAP
+    // over-map by one huge page and trim both ends so the block starts on a
+    // huge page boundary
+    size_t mappedBytes = size + kHugePageSize;
+    void *block = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (block != MAP_FAILED)
+    {
+        uintptr_t start = (uintptr_t)block;
+        uintptr_t aligned = (start + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1);
+        if (aligned > start)
+            munmap(block, aligned - start);
+        size_t tail = start + mappedBytes - (aligned + size);
+        if (tail > 0)
+            munmap((void *)(aligned + size), tail);
+
+        base = (char *)aligned;
+        mapped = true;
+#ifdef MADV_HUGEPAGE
+        huge = madvise(base, size, MADV_HUGEPAGE) == 0 && transparentHugePagesEnabled();
+#endif
+        return;
+    }
+#endif
+
+    base = static_cast<char *>(::operator new(size, std::align_val_t(kAlignment), std::nothrow));
+    if (base)
+        std::memset(base, 0, size);
+    else
+        size = 0;
+}
+
+Arena::~Arena()
+{
+    if (!base)
+        return;
+#ifdef SPH_ARENA_MMAP
+    if (mapped)
+    {
+        munmap(base, size);
+        return;
+    }
+#endif
+    ::operator delete(base, std::align_val_t(kAlignment));
+}
+
+void *Arena::allocate(size_t bytes)
+{
+    size_t start = blockBytes(offset);
+    if (start > size || bytes > size - start)
+        return nullptr;
+
+    // a fresh mapping reads as zeros and blocks are never handed out twice
+    offset = start + bytes;
+    return base + start;
+}
@@ -0,0 +1,410 @@
+#include "Particle.h"
+#include "Checkpoint.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPH_CHECKPOINT_MMAP
+#endif
+
+static uint64_t alignSection(uint64_t offset)
+{
+    return (offset + kCheckpointAlignment - 1) / kCheckpointAlignment * kCheckpointAlignment;
+}
+
+// the whole file, read-only: a private mapping where there is mmap, a copy in
+// memory elsewhere
+class CheckpointFile
+{
+public:
+    explicit CheckpointFile(const char *path)
+    {
+#ifdef SPH_CHECKPOINT_MMAP
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                bytes = (const char *)mapping;
+                size = (uint64_t)info.st_size;
+                // every array is read once, front to back
+                madvise(mapping, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return;
+        copy.resize((size_t)file.tellg());
+        file.seekg(0);
+        if (!file.read(copy.data(), copy.size()))
+            return;
+        bytes = copy.data();
+        size = copy.size();
+#endif
+    }
+
+    ~CheckpointFile()
+    {
+#ifdef SPH_CHECKPOINT_MMAP
+        if (bytes)
+            munmap((void *)bytes, size);
+#endif
+    }
+
+    CheckpointFile(const CheckpointFile &) = delete;
+    CheckpointFile &operator=(const CheckpointFile &) = delete;
+
+    const char *data() const { return bytes; }
+    uint64_t bytesInFile() const { return size; }
+
+private:
+    const char *bytes = nullptr;
+    uint64_t size = 0;
+#ifndef SPH_CHECKPOINT_MMAP
+    std::vector<char> copy;
+#endif
+};
+
+bool Particle::saveCheckpoint(const char *path) const
+{
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.version = kCheckpointVersion;
+    header.byteOrder = kCheckpointByteOrder;
+    header.headerBytes = sizeof(CheckpointHeader);
+    header.sectionCount = (uint32_t)CheckpointSection::Count;
+
+    header.particleCount = (uint32_t)numParticles;
+    header.idCount = (uint32_t)particleIndex.size();
+    header.freeIdCount = (uint32_t)freeIds.size();
+    header.emitterCount = (uint32_t)emitters.size();
+    header.killVolumeCount = (uint32_t)killVolumes.size();
+    header.windowWidth = WINDOW_W;
+    header.windowHeight = WINDOW_H;
+
+    header.radius = radius;
+    header.mass = mass;
+    header.gravity = GRAVITY;
+    header.particleSpacing = particleSpacing;
+    header.smoothingRadius = smoothingRadius;
+    header.targetDensity = targetDensity;
+    header.pressureMultiplier = pressureMultiplier;
+    header.neighborSkin = neighborSkin;
+    header.reorderThreshold = reorderThreshold;
+    header.cflNumber = cflNumber;
+    header.forceCflNumber = forceCflNumber;
+    header.minTimestep = minTimestep;
+    header.maxTimestep = maxTimestep;
+    header.substeps = substeps;
+    header.reorderInterval = reorderInterval;
+    header.pressureFormulation = (int32_t)pressureFormulation;
+    header.neighborsPerParticle = neighborsPerParticle;
+    header.useNeighborCache = useNeighborCache;
+    header.useVerletList = useVerletList;
+    header.useHalfNeighborList = useHalfNeighborList;
+    header.useSpatialReorder = useSpatialReorder;
+    header.useAdaptiveTimestep = useAdaptiveTimestep;
+    header.useSimdKernels = useSimdKernels;
+    header.running = running;
+
+    header.maxSpeed = maxSpeed;
+    header.maxAcceleration = maxAcceleration;
+    header.lastSubstepDt = lastSubstepDt;
+    header.gridDisorder = gridDisorder;
+    header.framesSinceReorder = framesSinceReorder;
+    header.lastSubsteps = lastSubsteps;
+    header.substepsTaken = substepsTaken;
+    header.particlesEmitted = particlesEmitted;
+    header.particlesRemoved = particlesRemoved;
+
+    // the sections in file order, as raw bytes
+    int n = numParticles;
+    std::vector<float> components[6];
+    const Vec2Array *vectors[3] = {&position, &previousPosition, &velocite};
+    for (int v = 0; v < 3; v++)
+    {
+        components[2 * v].resize(n);
+        components[2 * v + 1].resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            glm::vec2 value = (*vectors[v])[i];
+            components[2 * v][i] = value.x;
+            components[2 * v + 1][i] = value.y;
+        }
+    }
+
+    std::vector<CheckpointEmitter> emitterRecords;
+    for (const ParticleEmitter &e : emitters)
+    {
+        emitterRecords.push_back({{e.position.x, e.position.y}, {e.velocity.x, e.velocity.y}, e.width, e.travelled});
+    }
+    std::vector<CheckpointKillVolume> killVolumeRecords;
+    for (const KillVolume &k : killVolumes)
+    {
+        killVolumeRecords.push_back({{k.min.x, k.min.y}, {k.max.x, k.max.y}});
+    }
+
+    const void *sections[(int)CheckpointSection::Count] = {
+        components[0].data(), components[1].data(), components[2].data(),
+        components[3].data(), components[4].data(), components[5].data(),
+        densities.data(), particleId.data(), particleIndex.data(), freeIds.data(),
+        emitterRecords.data(), killVolumeRecords.data()};
+    uint64_t sectionBytes[(int)CheckpointSection::Count] = {
+        n * sizeof(float), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(int32_t), header.idCount * sizeof(int32_t),
+        header.freeIdCount * sizeof(int32_t),
+        header.emitterCount * sizeof(CheckpointEmitter), header.killVolumeCount * sizeof(CheckpointKillVolume)};
+
+    uint64_t offset = sizeof(CheckpointHeader);
+    for (int s = 0; s < (int)CheckpointSection::Count; s++)
+    {
+        offset = alignSection(offset);
+        header.sectionOffset[s] = offset;
+        header.sectionBytes[s] = sectionBytes[s];
+        offset += sectionBytes[s];
+    }
+    header.fileBytes = offset;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+        std::cerr << "ERROR: Could not write checkpoint " << path << std::endl;
+        return false;
+    }
+
+    static const char padding[kCheckpointAlignment] = {};
+    out.write((const char *)&header, sizeof(header));
+    uint64_t written = sizeof(header);
+    for (int s = 0; s < (int)CheckpointSection::Count; s++)
+    {
+        out.write(padding, header.sectionOffset[s] - written);
+        if (sectionBytes[s] > 0)
+            out.write((const char *)sections[s], sectionBytes[s]);
+        written = header.sectionOffset[s] + sectionBytes[s];
+    }
+
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Particle::loadCheckpoint(const char *path)
+{
+    CheckpointFile file(path);
+    if (!file.data())
+    {
+        std::cerr << "ERROR: Could not open checkpoint " << path << std::endl;
+        return false;
+    }
+
+    auto fail = [&](const char *reason)
+    {
+        std::cerr << "ERROR: " << path << ": " << reason << std::endl;
+        return false;
+    };
+
+    if (file.bytesInFile() < sizeof(CheckpointHeader))
+        return fail("too short for a checkpoint header");
+
+    // the mapping is page aligned, so the header can be read in place
+    const CheckpointHeader &header = *(const CheckpointHeader *)file.data();
+    if (std::memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) != 0)
+        return fail("not a checkpoint");
+    if (header.byteOrder != kCheckpointByteOrder)
+        return fail("written on a machine with a different byte order");
+    if (header.version != kCheckpointVersion || header.headerBytes != sizeof(CheckpointHeader) ||
+        header.sectionCount != (uint32_t)CheckpointSection::Count)
+        return fail("unsupported checkpoint version");
+    if (header.fileBytes != file.bytesInFile())
+        return fail("truncated");
+
+    uint64_t n = header.particleCount;
+    uint64_t expectedBytes[(int)CheckpointSection::Count] = {
+        n * sizeof(float), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(float), n * sizeof(float),
+        n * sizeof(float), n * sizeof(int32_t), header.idCount * (uint64_t)sizeof(int32_t),
+        header.freeIdCount * (uint64_t)sizeof(int32_t),
+        header.emitterCount * (uint64_t)sizeof(CheckpointEmitter),
+        header.killVolumeCount * (uint64_t)sizeof(CheckpointKillVolume)};
+    for (int s = 0; s < (int)CheckpointSection::Count; s++)
+    {
+        uint64_t offset = header.sectionOffset[s];
+        if (header.sectionBytes[s] != expectedBytes[s] || offset % kCheckpointAlignment != 0 ||
+            offset > header.fileBytes || header.sectionBytes[s] > header.fileBytes - offset)
+            return fail("section table does not match the header");
+    }
+    if (header.idCount < n || header.idCount > (uint64_t)INT32_MAX ||
+        header.freeIdCount != header.idCount - n)
+        return fail("particle ids do not match the particle count");
+    if (header.pressureFormulation != (int32_t)PressureFormulation::SharedPressure &&
+        header.pressureFormulation != (int32_t)PressureFormulation::Symmetric)
+        return fail("unknown pressure formulation");
+    // written so that NaNs fail too
+    if (!(header.minTimestep > 0.0f && header.maxTimestep >= header.minTimestep &&
+          header.maxTimestep < INFINITY))
+        return fail("timestep window out of range");
+    if (header.substeps < 1 || header.lastSubsteps < 0 || !(header.lastSubstepDt >= 0.0f) ||
+        !(header.lastSubstepDt < INFINITY))
+        return fail("substep fields out of range");
+    if (!(header.radius > 0.0f && header.radius < INFINITY) || !(header.mass > 0.0f && header.mass < INFINITY))
+        return fail("particle radius or mass out of range");
+    if (!(header.smoothingRadius > 0.0f && header.smoothingRadius < INFINITY) ||
+        !(header.neighborSkin >= 0.0f && header.neighborSkin < INFINITY))
+        return fail("smoothing radius or neighbor skin out of range");
+    if (header.neighborsPerParticle < 1 || header.reorderInterval < 1)
+        return fail("neighbor or reorder settings out of range");
+    // the grid resizeGrid will lay out for this window must fit its int cell count
+    float cellSize = std::max(header.smoothingRadius + (header.useVerletList ? header.neighborSkin : 0.0f), 0.01f);
+    double cols = std::max(1.0, std::ceil(header.windowWidth / 100.0 / cellSize));
+    double rows = std::max(1.0, std::ceil(header.windowHeight / 100.0 / cellSize));
+    if (header.windowWidth <= 0 || header.windowHeight <= 0 || cols * rows >= (double)INT32_MAX)
+        return fail("window size out of range");
+
+    auto section = [&](CheckpointSection s)
+    { return file.data() + header.sectionOffset[(int)s]; };
+    const float *xs[3] = {(const float *)section(CheckpointSection::PositionX),
+                          (const float *)section(CheckpointSection::PreviousPositionX),
+                          (const float *)section(CheckpointSection::VelocityX)};
+    const float *ys[3] = {(const float *)section(CheckpointSection::PositionY),
+                          (const float *)section(CheckpointSection::PreviousPositionY),
+                          (const float *)section(CheckpointSection::VelocityY)};
+    const int32_t *ids = (const int32_t *)section(CheckpointSection::ParticleId);
+    const int32_t *indices = (const int32_t *)section(CheckpointSection::ParticleIndex);
+    const int32_t *freeList = (const int32_t *)section(CheckpointSection::FreeIds);
+
+    // the id tables are followed blindly afterwards, so a bad one must not get in:
+    // every live id maps to its index and back, and every removed id is on the
+    // free list exactly once
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (ids[i] < 0 || (uint64_t)ids[i] >= header.idCount || indices[ids[i]] != (int32_t)i)
+            return fail("particle ids are inconsistent");
+    }
+    for (uint64_t id = 0; id < header.idCount; id++)
+    {
+        int32_t index = indices[id];
+        if (index != -1 && (index < 0 || (uint64_t)index >= n || ids[index] != (int32_t)id))
+            return fail("particle ids are inconsistent");
+    }
+    std::vector<char> listed(header.idCount, 0);
+    for (uint64_t f = 0; f < header.freeIdCount; f++)
+    {
+        int32_t id = freeList[f];
+        if (id < 0 || (uint64_t)id >= header.idCount || indices[id] != -1 || listed[id])
+            return fail("free particle ids are inconsistent");
+        listed[id] = 1;
+    }
+
+    WINDOW_W = header.windowWidth;
+    WINDOW_H = header.windowHeight;
+    radius = header.radius;
+    mass = header.mass;
+    GRAVITY = header.gravity;
+    particleSpacing = header.particleSpacing;
+    smoothingRadius = header.smoothingRadius;
+    recalculateSRConstant();
+    targetDensity = header.targetDensity;
+    pressureMultiplier = header.pressureMultiplier;
+    neighborSkin = header.neighborSkin;
+    reorderThreshold = header.reorderThreshold;
+    cflNumber = header.cflNumber;
+    forceCflNumber = header.forceCflNumber;
+    minTimestep = header.minTimestep;
+    maxTimestep = header.maxTimestep;
+    substeps = header.substeps;
+    reorderInterval = header.reorderInterval;
+    pressureFormulation = (PressureFormulation)header.pressureFormulation;
+    neighborsPerParticle = header.neighborsPerParticle;
+    useNeighborCache = header.useNeighborCache != 0;
+    useVerletList = header.useVerletList != 0;
+    useHalfNeighborList = header.useHalfNeighborList != 0;
+    useSpatialReorder = header.useSpatialReorder != 0;
+    useAdaptiveTimestep = header.useAdaptiveTimestep != 0;
+    useSimdKernels = header.useSimdKernels != 0;
+    running = header.running != 0;
+
+    maxSpeed = header.maxSpeed;
+    maxAcceleration = header.maxAcceleration;
+    lastSubstepDt = header.lastSubstepDt;
+    gridDisorder = header.gridDisorder;
+    framesSinceReorder = header.framesSinceReorder;
+    lastSubsteps = header.lastSubsteps;
+    substepsTaken = header.substepsTaken;
+    particlesEmitted = header.particlesEmitted;
+    particlesRemoved = header.particlesRemoved;
+
+    numParticles = (int)n;
+    if (numParticles > particleCapacity)
+        reserveCapacity(numParticles);
+
+    Vec2Array *vectors[3] = {&position, &previousPosition, &velocite};
+    for (int v = 0; v < 3; v++)
+    {
+        vectors[v]->resize(n);
+        for (int i = 0; i < numParticles; i++)
+        {
+            vectors[v]->set(i, {xs[v][i], ys[v][i]});
+        }
+    }
+    predictedPosition = position;
+    properties.assign(n, 1.0f);
+    densities.resize(n);
+    std::memcpy(densities.data(), section(CheckpointSection::Density), n * sizeof(float));
+    speed.resize(n);
+    for (int i = 0; i < numParticles; i++)
+    {
+        speed[i] = glm::length(velocite[i]);
+    }
+
+    particleId.resize(n);
+    std::memcpy(particleId.data(), ids, n * sizeof(int32_t));
+    particleIndex.resize(header.idCount);
+    std::memcpy(particleIndex.data(), indices, header.idCount * sizeof(int32_t));
+    freeIds.resize(header.freeIdCount);
+    std::memcpy(freeIds.data(), freeList, header.freeIdCount * sizeof(int32_t));
+
+    const CheckpointEmitter *emitterRecords = (const CheckpointEmitter *)section(CheckpointSection::Emitters);
+    emitters.clear();
+    for (uint32_t e = 0; e < header.emitterCount; e++)
+    {
+        const CheckpointEmitter &r = emitterRecords[e];
+        emitters.push_back({{r.position[0], r.position[1]}, {r.velocity[0], r.velocity[1]}, r.width, r.travelled});
+    }
+    const CheckpointKillVolume *killVolumeRecords =
+        (const CheckpointKillVolume *)section(CheckpointSection::KillVolumes);
+    killVolumes.clear();
+    for (uint32_t k = 0; k < header.killVolumeCount; k++)
+    {
+        const CheckpointKillVolume &r = killVolumeRecords[k];
+        killVolumes.push_back({{r.min[0], r.min[1]}, {r.max[0], r.max[1]}});
+    }
+
+    // derived state is rebuilt rather than stored; densities are kept as saved
+    // so the restored scene reads exactly as it was written
+    buildSpatialGrid(position);
+    if (usingNeighborList())
+        buildNeighborList();
+    // the list is not stored, so the first substep rebuilds it from its predicted
+    // positions
+    neighborListDirty = true;
+    return true;
+}
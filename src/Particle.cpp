@@ -1,16 +1,19 @@
 #include "Particle.h"
 #include <math.h>
+#include <cstring>
 #include <random>
 #include <algorithm>
-#include <SDL3/SDL.h>
+#include <atomic>
+#include <ctime>
 
 float Particle::targetDensity = 2.0f;
 float Particle::pressureMultiplier = 10.0f;
 
-bool leftMouseDown = false;
-bool rightMouseDown = false;
+Particle::Particle(int W, int H) : Particle(W, H, (unsigned int)time(NULL))
+{
+}
 
-Particle::Particle(int W, int H) : WINDOW_W(W), WINDOW_H(H)
+Particle::Particle(int W, int H, unsigned int seed) : WINDOW_W(W), WINDOW_H(H)
 {
     radius = 0.038f;
     particleSpacing = 0.0f;
@@ -19,7 +22,9 @@ Particle::Particle(int W, int H) : WINDOW_W(W), WINDOW_H(H)
     float halfW = (W / 2.0f) / 100.0f;
     float halfH = (H / 2.0f) / 100.0f;
 
-    srand(time(NULL));
+    reserveCapacity(numParticles);
+
+    srand(seed);
     for (int i = 0; i < numParticles; i++)
     {
         float rx = static_cast<float>(rand()) / RAND_MAX;
@@ -34,9 +39,11 @@ Particle::Particle(int W, int H) : WINDOW_W(W), WINDOW_H(H)
         predictedPosition.push_back({x, y});
     }
 
+    resetParticleIds();
+    previousPosition = position;
+    buildSpatialGrid(position);
     updateDensities(position);
     speed.resize(numParticles, 0.0f);
-    cellSize = smoothingRadius;
 
     coefKernel = 4.0f / (M_PI * pow(smoothingRadius, 8));
     coefGradient = -30.0f / (M_PI * pow(smoothingRadius, 5));
@@ -50,43 +57,127 @@ void Particle::update(float dt)
 {
     if (running)
     {
-        int iterations = 2;
+        SPH_PROFILE_SCOPE(profiler, Step);
+
+        if (!emitters.empty() || !killVolumes.empty())
+        {
+            SPH_PROFILE_SCOPE(profiler, Grid);
+            applyEmittersAndKillVolumes(dt);
+        }
+
+        framesSinceReorder++;
+        if (useSpatialReorder &&
+            (framesSinceReorder >= reorderInterval || gridDisorder > reorderThreshold))
+        {
+            SPH_PROFILE_SCOPE(profiler, Grid);
+            reorderParticles();
+        }
+
+        previousPosition = position;
+
+        int iterations = std::max(1, substeps);
+        if (useAdaptiveTimestep)
+        {
+            // a hair under a whole number of stable substeps does not need another one
+            iterations = std::max(1, (int)std::ceil(dt / stableTimestep() - 1e-3f));
+        }
         float sub_dt = dt / iterations;
 
+        lastSubsteps = iterations;
+        lastSubstepDt = sub_dt;
+        substepsTaken += iterations;
+
+        // gravity is applied once per update below, but it still counts towards
+        // the acceleration that limits the substep
+        glm::vec2 gravity(0.0f, GRAVITY);
+        int threads = threadPool.getThreadCount();
+        threadMaxSpeedSq.assign(threads, 0.0f);
+        threadMaxAccelerationSq.assign(threads, 0.0f);
+
         for (int iter = 0; iter < iterations; iter++)
         {
-            for (int i = 0; i < numParticles; i++)
             {
-                predictedPosition[i] = position[i] + velocite[i] * sub_dt;
+                SPH_PROFILE_SCOPE(profiler, Integrate);
+                threadPool.parallelFor(numParticles, [&](int begin, int end, int)
+                {
+                    for (int i = begin; i < end; i++)
+                    {
+                        predictedPosition.set(i, position[i] + velocite[i] * sub_dt);
+                    }
+                });
             }
 
-            buildSpatialGrid(predictedPosition);
-            updateDensities(predictedPosition);
-            updatePressures();
+            {
+                SPH_PROFILE_SCOPE(profiler, Grid);
+                if (usingNeighborList())
+                {
+                    SPH_PROFILE_SCOPE(profiler, NeighborList);
+                    updateNeighborList();
+                }
+                else
+                {
+                    buildSpatialGrid(predictedPosition);
+                }
+            }
 
-            applyContinuousMousePressure();
+            {
+                SPH_PROFILE_SCOPE(profiler, Density);
+                updateDensities(predictedPosition);
+                updatePressures();
+            }
 
-            for (int i = 0; i < numParticles; i++)
+            if (usingSimdKernels())
             {
-                glm::vec2 pressureForce = calculatePressureForce(i);
-                velocite[i] += (pressureForce / (densities[i] + 1e-6f)) * sub_dt;
+                SPH_PROFILE_SCOPE(profiler, Grid);
+                gatherSortedFields();
             }
 
-            for (int i = 0; i < numParticles; i++)
             {
-                position[i] += velocite[i] * sub_dt;
+                SPH_PROFILE_SCOPE(profiler, Pressure);
+                applyContinuousMousePressure();
+                if (useHalfNeighborList)
+                {
+                    updateHalfPressureSums();
+                }
+
+                threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+                {
+                    float maxAccelerationSq = threadMaxAccelerationSq[t];
+                    for (int i = begin; i < end; i++)
+                    {
+                        glm::vec2 pressureForce;
+                        if (useHalfNeighborList)
+                            pressureForce = pressureForceScale(i) * pressureSums[i];
+                        else if (usingNeighborList())
+                            pressureForce = calculateCachedPressureForce(i);
+                        else if (usingSimdKernels())
+                            pressureForce = calculateSimdPressureForce(i);
+                        else
+                            pressureForce = calculatePressureForce(i);
+
+                        glm::vec2 acceleration = pressureForce / (densities[i] + 1e-6f);
+                        glm::vec2 net = acceleration + gravity;
+                        maxAccelerationSq = std::max(maxAccelerationSq, glm::dot(net, net));
+                        velocite.add(i, acceleration * sub_dt);
+                    }
+                    threadMaxAccelerationSq[t] = maxAccelerationSq;
+                });
             }
-        }
 
-        for (int i = 0; i < numParticles; i++)
-        {
-            velocite[i].y += GRAVITY * dt;
-        }
-        for (int i = 0; i < numParticles; i++)
-        {
-            speed[i] = glm::length(velocite[i]);
+            {
+                SPH_PROFILE_SCOPE(profiler, Integrate);
+                threadPool.parallelFor(numParticles, [&](int begin, int end, int)
+                {
+                    for (int i = begin; i < end; i++)
+                    {
+                        position.add(i, velocite[i] * sub_dt);
+                    }
+                });
+            }
         }
 
+        SPH_PROFILE_SCOPE(profiler, Boundaries);
+
         float worldLeft = -((float)WINDOW_W / 2.0f) / 100.0f;
         float worldRight = ((float)WINDOW_W / 2.0f) / 100.0f;
         float worldBottom = -((float)WINDOW_H / 2.0f) / 100.0f;
@@ -94,90 +185,116 @@ void Particle::update(float dt)
 
         float margin = radius;
 
-        for (int i = 0; i < numParticles; i++)
+        threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
         {
-            if (position[i].y - margin < worldBottom)
+            float maxSpeedSq = 0.0f;
+            for (int i = begin; i < end; i++)
             {
-                position[i].y = worldBottom + margin;
-                velocite[i].y *= -0.3f;
-            }
-            if (position[i].y + margin > worldTop)
-            {
-                position[i].y = worldTop - margin;
-                velocite[i].y *= -0.3f;
-            }
-            if (position[i].x - margin < worldLeft)
-            {
-                position[i].x = worldLeft + margin;
-                velocite[i].x *= -0.3f;
-            }
-            if (position[i].x + margin > worldRight)
-            {
-                position[i].x = worldRight - margin;
-                velocite[i].x *= -0.3f;
+                velocite.y(i) += GRAVITY * dt;
+                speed[i] = glm::length(velocite[i]);
+                maxSpeedSq = std::max(maxSpeedSq, speed[i] * speed[i]);
+
+                if (position.y(i) - margin < worldBottom)
+                {
+                    position.y(i) = worldBottom + margin;
+                    velocite.y(i) *= -0.3f;
+                }
+                if (position.y(i) + margin > worldTop)
+                {
+                    position.y(i) = worldTop - margin;
+                    velocite.y(i) *= -0.3f;
+                }
+                if (position.x(i) - margin < worldLeft)
+                {
+                    position.x(i) = worldLeft + margin;
+                    velocite.x(i) *= -0.3f;
+                }
+                if (position.x(i) + margin > worldRight)
+                {
+                    position.x(i) = worldRight - margin;
+                    velocite.x(i) *= -0.3f;
+                }
             }
+            threadMaxSpeedSq[t] = maxSpeedSq;
+        });
+
+        // max is order independent, so these do not depend on the thread count
+        float maxSpeedSq = 0.0f;
+        float maxAccelerationSq = 0.0f;
+        for (int t = 0; t < threads; t++)
+        {
+            maxSpeedSq = std::max(maxSpeedSq, threadMaxSpeedSq[t]);
+            maxAccelerationSq = std::max(maxAccelerationSq, threadMaxAccelerationSq[t]);
         }
+        maxSpeed = std::sqrt(maxSpeedSq);
+        maxAcceleration = std::sqrt(maxAccelerationSq);
     }
-}
 
-void Particle::updateDensities(std::vector<glm::vec2> predictedPosition)
-{
-    densities.resize(numParticles);
-    for (int i = 0; i < numParticles; i++)
-    {
-        densities[i] = calculateDensity(predictedPosition[i]);
-    }
+    SPH_PROFILE_FRAME(profiler);
 }
 
-void Particle::OnEvent(SDL_Event &e)
+float Particle::stableTimestep() const
 {
-    float mx, my;
-    SDL_GetMouseState(&mx, &my);
+    float h = smoothingRadius;
+    float dt = maxTimestep;
 
-    float worldX = (mx - WINDOW_W / 2.0f) / 100.0f;
-    float worldY = (WINDOW_H / 2.0f - my) / 100.0f;
-    glm::vec2 mouseWorldPos = {worldX, -worldY};
+    if (maxSpeed > 0.0f)
+        dt = std::min(dt, cflNumber * h / maxSpeed);
 
-    if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN)
+    // before the first update only gravity is known
+    float acceleration = maxAcceleration > 0.0f ? maxAcceleration : std::abs(GRAVITY);
+    if (acceleration > 0.0f)
+        dt = std::min(dt, forceCflNumber * std::sqrt(h / acceleration));
+
+    return std::max(dt, minTimestep);
+}
+
+void Particle::interpolatePositions(float alpha, glm::vec2 *out)
+{
+    if (previousPosition.size() != position.size())
     {
-        if (e.button.button == SDL_BUTTON_LEFT)
-        {
-            leftMouseDown = true;
-            applyMousePressure(mouseWorldPos, 10.0f, 1.0f);
-        }
-        else if (e.button.button == SDL_BUTTON_RIGHT)
-        {
-            rightMouseDown = true;
-            applyMousePressure(mouseWorldPos, -1.0f, 4.0f);
-        }
-        else if (e.button.button == SDL_BUTTON_MIDDLE)
-        {
-            float z = calculateDensity(mouseWorldPos);
-            std::cout << "Density: " << z << " | Pressure: " << convertDensityToPressure(z) << std::endl;
-        }
+        position.copyInterleaved(out, numParticles);
+        return;
     }
-    else if (e.type == SDL_EVENT_MOUSE_BUTTON_UP)
+
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
     {
-        if (e.button.button == SDL_BUTTON_LEFT)
-        {
-            leftMouseDown = false;
-        }
-        else if (e.button.button == SDL_BUTTON_RIGHT)
+        for (int i = begin; i < end; i++)
         {
-            rightMouseDown = false;
+            glm::vec2 previous = previousPosition[i];
+            out[i] = previous + (position[i] - previous) * alpha;
         }
+    });
+}
+
+void Particle::updateDensities(Vec2View samplePositions)
+{
+    if (useHalfNeighborList)
+    {
+        updateHalfDensities();
+        return;
     }
-    else if (e.type == SDL_EVENT_MOUSE_MOTION)
+
+    densities.resize(numParticles);
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
     {
-        if (e.motion.state & SDL_BUTTON_LMASK)
-        {
-            applyMousePressure(mouseWorldPos, 1.0f, 0.8f);
-        }
-        else if (e.motion.state & SDL_BUTTON_RMASK)
+        for (int i = begin; i < end; i++)
         {
-            applyMousePressure(mouseWorldPos, -0.3f, 4.0f);
+            if (usingNeighborList())
+                densities[i] = calculateCachedDensity(i);
+            else if (usingSimdKernels())
+                densities[i] = calculateSimdDensity(samplePositions[i]);
+            else
+                densities[i] = calculateDensity(samplePositions[i]);
         }
-    }
+    });
+}
+
+void Particle::setMouseState(glm::vec2 worldPos, bool leftDown, bool rightDown)
+{
+    mouseWorldPos = worldPos;
+    leftMouseDown = leftDown;
+    rightMouseDown = rightDown;
 }
 
 void Particle::applyContinuousMousePressure()
@@ -185,13 +302,6 @@ void Particle::applyContinuousMousePressure()
     if (!leftMouseDown && !rightMouseDown)
         return;
 
-    float mx, my;
-    SDL_GetMouseState(&mx, &my);
-
-    float worldX = (mx - WINDOW_W / 2.0f) / 100.0f;
-    float worldY = (WINDOW_H / 2.0f - my) / 100.0f;
-    glm::vec2 mouseWorldPos = {worldX, -worldY};
-
     if (leftMouseDown)
     {
         applyMousePressure(mouseWorldPos, 1.0f, 0.8f);
@@ -204,30 +314,188 @@ void Particle::applyContinuousMousePressure()
 
 void Particle::MakeGrid()
 {
-    position.clear();
-    velocite.clear();
-    properties.clear();
-    predictedPosition.clear();
-
-    int ppr = (int)std::sqrt(numParticles);
+    // an empty scene is allowed, it just lays out no rows
+    numParticles = std::max(numParticles, 0);
+    int ppr = std::max(1, (int)std::sqrt(numParticles));
     int ppc = (numParticles - 1) / ppr + 1;
     float spacing = 2.0f * radius + particleSpacing;
 
+    std::vector<glm::vec2> grid(numParticles);
     for (int i = 0; i < numParticles; i++)
     {
         float x = (i % ppr - ppr / 2.0f + 0.5f) * spacing;
         float y = (i / ppr - ppc / 2.0f + 0.5f) * spacing;
+        grid[i] = {x, y};
+    }
 
-        position.push_back({x, y});
-        predictedPosition.push_back({x, y});
+    SetParticles(grid);
+}
+
+void Particle::SetParticles(const std::vector<glm::vec2> &positions)
+{
+    if ((int)positions.size() > particleCapacity)
+        reserveCapacity((int)positions.size());
+    numParticles = (int)positions.size();
+
+    position.clear();
+    velocite.clear();
+    properties.clear();
+    predictedPosition.clear();
+
+    for (glm::vec2 pos : positions)
+    {
+        position.push_back(pos);
+        predictedPosition.push_back(pos);
         velocite.push_back({0.0f, 0.0f});
         properties.push_back(1.0f);
     }
 
+    resetParticleIds();
+    previousPosition = position;
+    maxSpeed = 0.0f;
+    maxAcceleration = 0.0f;
+    buildSpatialGrid(position);
+    neighborListDirty = true;
+    // the cached density pass reads the list, which still describes the old scene
+    if (usingNeighborList())
+        buildNeighborList();
     updateDensities(position);
     speed.resize(numParticles, 0.0f);
 }
 
+int Particle::emitParticle(glm::vec2 pos, glm::vec2 velocity)
+{
+    if (numParticles >= particleCapacity)
+        reserveCapacity(std::max(2 * particleCapacity, 64));
+
+    int id;
+    if (freeIds.size() > 0)
+    {
+        id = freeIds[freeIds.size() - 1];
+        freeIds.resize(freeIds.size() - 1);
+    }
+    else
+    {
+        id = (int)particleIndex.size();
+        particleIndex.push_back(-1);
+    }
+
+    int index = numParticles++;
+    position.resize(numParticles);
+    previousPosition.resize(numParticles);
+    predictedPosition.resize(numParticles);
+    velocite.resize(numParticles);
+    position.set(index, pos);
+    previousPosition.set(index, pos);
+    predictedPosition.set(index, pos);
+    velocite.set(index, velocity);
+
+    // densities and pressures are recomputed before the next force pass
+    properties.resize(numParticles, 1.0f);
+    densities.resize(numParticles, targetDensity);
+    speed.resize(numParticles, 0.0f);
+    properties[index] = 1.0f;
+    densities[index] = targetDensity;
+    speed[index] = glm::length(velocity);
+
+    particleId.resize(numParticles);
+    particleId[index] = id;
+    particleIndex[id] = index;
+
+    neighborListDirty = true;
+    particlesEmitted++;
+    return id;
+}
+
+// new[index] = old[last] for a per-particle array, when it holds both
+template <typename Array>
+static void moveLastInto(Array &values, int index, int last)
+{
+    if ((int)values.size() > last)
+    {
+        values[index] = values[last];
+        values.resize(last);
+    }
+}
+
+static void moveLastInto(Vec2Array &values, int index, int last)
+{
+    if ((int)values.size() > last)
+    {
+        values.set(index, values[last]);
+        values.resize(last);
+    }
+}
+
+void Particle::removeParticle(int index)
+{
+    int last = numParticles - 1;
+    int removedId = particleId[index];
+
+    moveLastInto(position, index, last);
+    moveLastInto(previousPosition, index, last);
+    moveLastInto(velocite, index, last);
+    moveLastInto(predictedPosition, index, last);
+    moveLastInto(properties, index, last);
+    moveLastInto(densities, index, last);
+    moveLastInto(pressures, index, last);
+    moveLastInto(inverseDensities, index, last);
+    moveLastInto(pressureOverDensitySq, index, last);
+    moveLastInto(speed, index, last);
+    moveLastInto(particleId, index, last);
+
+    if (index != last)
+        particleIndex[particleId[index]] = index;
+    particleIndex[removedId] = -1;
+    freeIds.push_back(removedId);
+
+    numParticles = last;
+    neighborListDirty = true;
+    particlesRemoved++;
+}
+
+void Particle::applyEmittersAndKillVolumes(float dt)
+{
+    // walking down, the particle swapped into i has already been checked
+    for (int i = numParticles - 1; i >= 0; i--)
+    {
+        glm::vec2 pos = position[i];
+        for (const KillVolume &volume : killVolumes)
+        {
+            if (pos.x >= volume.min.x && pos.x <= volume.max.x && pos.y >= volume.min.y && pos.y <= volume.max.y)
+            {
+                removeParticle(i);
+                break;
+            }
+        }
+    }
+
+    float spacing = 2.0f * radius + particleSpacing;
+    for (ParticleEmitter &emitter : emitters)
+    {
+        float flowSpeed = glm::length(emitter.velocity);
+        if (flowSpeed <= 0.0f || spacing <= 0.0f)
+            continue;
+
+        glm::vec2 along = emitter.velocity / flowSpeed;
+        glm::vec2 across(-along.y, along.x);
+        int perRow = std::max(1, (int)(emitter.width / spacing));
+
+        // each row starts as far downstream as the flow has carried it past the emitter
+        emitter.travelled += flowSpeed * dt;
+        while (emitter.travelled >= spacing)
+        {
+            emitter.travelled -= spacing;
+            glm::vec2 rowCenter = emitter.position + along * emitter.travelled;
+            for (int k = 0; k < perRow; k++)
+            {
+                float offset = (k - (perRow - 1) / 2.0f) * spacing;
+                emitParticle(rowCenter + across * offset, emitter.velocity);
+            }
+        }
+    }
+}
+
 // float Particle::smoothingKernel(float sr, float dst)
 // {
 //     if (dst >= sr)
@@ -250,10 +518,16 @@ void Particle::MakeGrid()
 // Poly6 kernel for 2D
 float Particle::smoothingKernel(float sr, float r)
 {
-    if (r >= sr)
+    return smoothingKernelSq(sr * sr, r * r);
+}
+
+// Poly6 only depends on r^2, so the density path never needs a sqrt
+float Particle::smoothingKernelSq(float sr2, float r2)
+{
+    if (r2 >= sr2)
         return 0.0f;
 
-    float diff = (sr * sr - r * r);
+    float diff = sr2 - r2;
     return coefKernel * diff * diff * diff;
 }
 
@@ -267,23 +541,25 @@ glm::vec2 Particle::smoothingKernelGradient(float sr, glm::vec2 vec)
     return coefGradient * factor * (vec / r);
 }
 
+glm::vec2 Particle::smoothingKernelGradient(float sr, float dst, glm::vec2 dir)
+{
+    if (dst <= 0.0f || dst >= sr)
+        return glm::vec2(0.0f);
+
+    float factor = (sr - dst) * (sr - dst);
+    return coefGradient * factor * dir;
+}
+
 float Particle::calculateDensity(glm::vec2 samplePoint)
 {
     float density = 0.0f;
     float sr = std::max(0.1f, smoothingRadius);
+    float sr2 = sr * sr;
 
-    std::vector<int> neighbors = getNeighbors(samplePoint);
-
-    for (int particleIndex : neighbors)
+    forEachNeighbor(samplePoint, [&](int, float dst2)
     {
-        glm::vec2 vec = predictedPosition[particleIndex] - samplePoint;
-        float dst = glm::length(vec);
-
-        if (dst < sr)
-        {
-            density += mass * smoothingKernel(sr, dst);
-        }
-    }
+        density += mass * smoothingKernelSq(sr2, dst2);
+    });
 
     return density;
 }
@@ -291,15 +567,16 @@ float Particle::calculateDensity(glm::vec2 samplePoint)
 float Particle::calculateProperty(glm::vec2 point)
 {
     float property = 0.0f;
+    float sr2 = smoothingRadius * smoothingRadius;
 
     for (int i = 0; i < numParticles; i++)
     {
         glm::vec2 vec = point - position[i];
-        float dst = glm::length(vec);
+        float dst2 = glm::dot(vec, vec);
 
-        if (densities[i] > 0.0f && dst < smoothingRadius)
+        if (densities[i] > 0.0f && dst2 < sr2)
         {
-            float weight = smoothingKernel(smoothingRadius, dst);
+            float weight = smoothingKernelSq(sr2, dst2);
             property += -(properties[i] * (mass / densities[i])) * weight;
         }
     }
@@ -307,34 +584,238 @@ float Particle::calculateProperty(glm::vec2 point)
     return property;
 }
 
+// constant factor of the pressure force sums below: the shared-pressure form
+// halves (P_i + P_j), the symmetric one is scaled by rho_i so that the caller's
+// division by the density leaves the usual -m^2 sum (P_i/rho_i^2 + P_j/rho_j^2) grad W
+float Particle::pressureForceScale(int particleIndex) const
+{
+    if (pressureFormulation == PressureFormulation::Symmetric)
+        return -mass * mass * densities[particleIndex];
+    return -mass * mass * 0.5f;
+}
+
 glm::vec2 Particle::calculatePressureForce(int particleIndex)
 {
-    glm::vec2 pressureForce(0.0f);
+    glm::vec2 sum(0.0f);
+    glm::vec2 samplePoint = predictedPosition[particleIndex];
+
+    bool symmetric = pressureFormulation == PressureFormulation::Symmetric;
+    const float *terms = symmetric ? pressureOverDensitySq.data() : pressures.data();
+    float term = terms[particleIndex];
+    float inverseDensity = inverseDensities[particleIndex];
+
+    forEachNeighbor(samplePoint, [&](int i, float dst2)
+    {
+        if (i == particleIndex || dst2 <= 0.0f)
+            return;
+
+        // the only sqrt of the pair, shared by the falloff and the direction
+        float dst = std::sqrt(dst2);
+        glm::vec2 vec = samplePoint - predictedPosition[i];
+
+        float pairTerm = term + terms[i];
+        if (!symmetric)
+            pairTerm *= inverseDensity + inverseDensities[i];
+        sum += pairTerm * smoothingKernelGradient(smoothingRadius, dst, vec / dst);
+    });
+
+    return pressureForceScale(particleIndex) * sum;
+}
+
+float Particle::calculateCachedDensity(int particleIndex)
+{
+    float density = 0.0f;
+    float sr = std::max(0.1f, smoothingRadius);
+    float sr2 = sr * sr;
+
+    for (int k = neighborStart[particleIndex]; k < neighborStart[particleIndex + 1]; k++)
+    {
+        density += mass * smoothingKernelSq(sr2, neighborDistanceSq[k]);
+    }
+
+    return density;
+}
+
+glm::vec2 Particle::calculateCachedPressureForce(int particleIndex)
+{
+    glm::vec2 sum(0.0f);
     glm::vec2 samplePoint = predictedPosition[particleIndex];
 
-    std::vector<int> neighbors = getNeighbors(samplePoint);
+    bool symmetric = pressureFormulation == PressureFormulation::Symmetric;
+    const float *terms = symmetric ? pressureOverDensitySq.data() : pressures.data();
+    float term = terms[particleIndex];
+    float inverseDensity = inverseDensities[particleIndex];
 
-    for (int i : neighbors)
+    for (int k = neighborStart[particleIndex]; k < neighborStart[particleIndex + 1]; k++)
     {
-        if (i == particleIndex)
+        int i = neighborIndex[k];
+        float dst2 = neighborDistanceSq[k];
+
+        if (i == particleIndex || dst2 <= 0.0f)
             continue;
 
+        // as in calculatePressureForce, the pair's only sqrt
+        float dst = std::sqrt(dst2);
         glm::vec2 vec = samplePoint - predictedPosition[i];
-        float dst = glm::length(vec);
 
-        if (dst > 0.0f && dst < smoothingRadius)
+        float pairTerm = term + terms[i];
+        if (!symmetric)
+            pairTerm *= inverseDensity + inverseDensities[i];
+        sum += pairTerm * smoothingKernelGradient(smoothingRadius, dst, vec / dst);
+    }
+
+    return pressureForceScale(particleIndex) * sum;
+}
+
+// visits every pair k of the half list once: pairValue(i, k) is added to
+// particle i and sign * pairValue(i, k) to its neighbor. Each thread adds
+// straight into its own chunk, which no other thread writes during the pass, and
+// queues the rest for the owning thread to add once all pairs are done
+template <typename T, typename Fn>
+void Particle::accumulateHalfPairs(AlignedBuffer<T> &sums, AlignedBuffer<T> &spillValues, T initial, float sign,
+                                   Fn &&pairValue)
+{
+    int threads = threadPool.getThreadCount();
+    int pairs = neighborStart[numParticles];
+    sums.resize(numParticles);
+    spillValues.resize(pairs);
+    spillPairs.resize(pairs);
+    spillStart.resize((size_t)threads * threads);
+    spillEnd.resize((size_t)threads * threads);
+
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+    {
+        // a chunk spills at most one entry per pair, so its queues fit in the
+        // chunk's own range of pair slots; count them first to lay them out
+        int *starts = &spillStart[(size_t)t * threads];
+        int *ends = &spillEnd[(size_t)t * threads];
+        std::fill(ends, ends + threads, 0);
+        for (int k = neighborStart[begin]; k < neighborStart[end]; k++)
+        {
+            int j = neighborIndex[k];
+            if (j >= end)
+                ends[threadPool.chunkOf(numParticles, j)]++;
+        }
+        int offset = neighborStart[begin];
+        for (int u = 0; u < threads; u++)
         {
-            glm::vec2 gradW = smoothingKernelGradient(smoothingRadius, vec);
+            starts[u] = offset;
+            offset += ends[u];
+            ends[u] = starts[u];
+        }
+
+        std::fill(sums.begin() + begin, sums.begin() + end, initial);
 
-            float pressure_i = convertDensityToPressure(densities[particleIndex]);
-            float pressure_j = convertDensityToPressure(densities[i]);
+        for (int i = begin; i < end; i++)
+        {
+            T sum = sums[i];
+            for (int k = neighborStart[i]; k < neighborStart[i + 1]; k++)
+            {
+                int j = neighborIndex[k];
+                T value = pairValue(i, k);
+                sum += value;
 
-            float sharedPressure = (pressure_i + pressure_j) / 2.0f;
-            pressureForce += -mass * mass * sharedPressure * (1.0f / densities[i] + 1.0f / densities[particleIndex]) * gradW;
+                // j > i, so it is either later in this chunk or in a later one
+                if (j < end)
+                {
+                    sums[j] += sign * value;
+                }
+                else
+                {
+                    spillValues[k] = sign * value;
+                    spillPairs[ends[threadPool.chunkOf(numParticles, j)]++] = k;
+                }
+            }
+            sums[i] = sum;
         }
-    }
+    });
 
-    return pressureForce;
+    threadPool.parallelFor(numParticles, [&](int, int, int u)
+    {
+        for (int t = 0; t < threads; t++)
+        {
+            size_t queue = (size_t)t * threads + u;
+            for (int s = spillStart[queue]; s < spillEnd[queue]; s++)
+            {
+                int k = spillPairs[s];
+                sums[neighborIndex[k]] += spillValues[k];
+            }
+        }
+    });
+}
+
+void Particle::updateHalfDensities()
+{
+    float sr = std::max(0.1f, smoothingRadius);
+    float sr2 = sr * sr;
+
+    // the half list leaves out the particle itself
+    float selfDensity = mass * smoothingKernelSq(sr2, 0.0f);
+    accumulateHalfPairs(densities, densitySpillValues, selfDensity, 1.0f, [&](int, int k)
+    {
+        return mass * smoothingKernelSq(sr2, neighborDistanceSq[k]);
+    });
+}
+
+// the sums calculateCachedPressureForce builds, with each pair evaluated once:
+// the pair term is symmetric and the gradient flips sign for the neighbor
+void Particle::updateHalfPressureSums()
+{
+    bool symmetric = pressureFormulation == PressureFormulation::Symmetric;
+    const float *terms = symmetric ? pressureOverDensitySq.data() : pressures.data();
+
+    accumulateHalfPairs(pressureSums, pressureSpillValues, glm::vec2(0.0f), -1.0f, [&](int i, int k)
+    {
+        int j = neighborIndex[k];
+        float dst2 = neighborDistanceSq[k];
+        if (dst2 <= 0.0f)
+            return glm::vec2(0.0f);
+
+        float dst = std::sqrt(dst2);
+        glm::vec2 vec = predictedPosition[i] - predictedPosition[j];
+
+        float pairTerm = terms[i] + terms[j];
+        if (!symmetric)
+            pairTerm *= inverseDensities[i] + inverseDensities[j];
+        return pairTerm * smoothingKernelGradient(smoothingRadius, dst, vec / dst);
+    });
+}
+
+float Particle::calculateSimdDensity(glm::vec2 samplePoint)
+{
+    SimdKernels kernels = getSimdKernels(simdLevel);
+    float sr = std::max(0.1f, smoothingRadius);
+    float sum = 0.0f;
+
+    forEachCellRun(samplePoint, [&](int begin, int end)
+    {
+        sum += kernels.densitySum(sortedX.data() + begin, sortedY.data() + begin, end - begin,
+                                  samplePoint.x, samplePoint.y, sr * sr, smoothingRadius * smoothingRadius);
+    });
+
+    return mass * coefKernel * sum;
+}
+
+glm::vec2 Particle::calculateSimdPressureForce(int particleIndex)
+{
+    SimdKernels kernels = getSimdKernels(simdLevel);
+    glm::vec2 samplePoint = predictedPosition[particleIndex];
+    glm::vec2 sum(0.0f);
+
+    bool symmetric = pressureFormulation == PressureFormulation::Symmetric;
+    float term = symmetric ? pressureOverDensitySq[particleIndex] : pressures[particleIndex];
+    const float *sortedInverse = symmetric ? nullptr : sortedInverseDensity.data();
+
+    forEachCellRun(samplePoint, [&](int begin, int end)
+    {
+        sum += kernels.pressureSum(sortedX.data() + begin, sortedY.data() + begin,
+                                   sortedPressureTerm.data() + begin, sortedInverse ? sortedInverse + begin : nullptr,
+                                   end - begin, samplePoint.x, samplePoint.y,
+                                   term, inverseDensities[particleIndex], smoothingRadius);
+    });
+
+    // the kernel leaves out the gradient coefficient
+    return pressureForceScale(particleIndex) * coefGradient * sum;
 }
 
 float Particle::convertDensityToPressure(float density)
@@ -344,76 +825,541 @@ float Particle::convertDensityToPressure(float density)
     return pressure;
 }
 
+// per-particle terms of the pressure force, so the pair loops only add and multiply
 void Particle::updatePressures()
 {
     pressures.resize(numParticles);
+    inverseDensities.resize(numParticles);
+    pressureOverDensitySq.resize(numParticles);
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            float pressure = convertDensityToPressure(densities[i]);
+            float inverseDensity = 1.0f / densities[i];
+            pressures[i] = pressure;
+            inverseDensities[i] = inverseDensity;
+            pressureOverDensitySq[i] = pressure * inverseDensity * inverseDensity;
+        }
+    });
+}
+
+void Particle::resizeGrid()
+{
+    cellSize = std::max(neighborSearchRadius(), 0.01f);
+
+    float halfW = (WINDOW_W / 2.0f) / 100.0f;
+    float halfH = (WINDOW_H / 2.0f) / 100.0f;
+    gridOrigin = {-halfW, -halfH};
+    gridCols = std::max(1, (int)std::ceil(2.0f * halfW / cellSize));
+    gridRows = std::max(1, (int)std::ceil(2.0f * halfH / cellSize));
+
+    // resize keeps capacity, so this only allocates when the grid grows
+    cellStart.resize(gridCols * gridRows + 1);
+}
+
+// particles outside the window are clamped into the border cells; clamping never
+// increases the cell distance between two points, so neighbor queries stay exact
+int Particle::getCellX(float x)
+{
+    int cx = (int)std::floor((x - gridOrigin.x) / cellSize);
+    return std::clamp(cx, 0, gridCols - 1);
+}
+
+int Particle::getCellY(float y)
+{
+    int cy = (int)std::floor((y - gridOrigin.y) / cellSize);
+    return std::clamp(cy, 0, gridRows - 1);
+}
+
+int Particle::getCellIndex(glm::vec2 position)
+{
+    return getCellY(position.y) * gridCols + getCellX(position.x);
+}
+
+// Counting sort in three parallel passes: per-thread cell histograms over the
+// static particle chunks, a prefix sum split over cell ranges, and a scatter where
+// each thread writes its chunk through its own offsets. Chunks are in particle
+// order, so every cell lists its particles ascending whatever the thread count.
+void Particle::buildSpatialGrid(Vec2View gridPositions)
+{
+    resizeGrid();
+    particleCell.resize(numParticles);
+    cellParticles.resize(numParticles);
+
+    // the vector kernels may load a full register past the last particle
+    sortedX.reserve(numParticles + kSimdLanes);
+    sortedY.reserve(numParticles + kSimdLanes);
+    sortedX.resize(numParticles);
+    sortedY.resize(numParticles);
+
+    int numCells = gridCols * gridRows;
+    int threads = threadPool.getThreadCount();
+    cellHistogram.resize((size_t)threads * numCells);
+    threadPartial.resize(threads + 1);
+
+    // count particles per cell, one histogram row per thread
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+    {
+        int *histogram = &cellHistogram[(size_t)t * numCells];
+        std::fill(histogram, histogram + numCells, 0);
+
+        for (int i = begin; i < end; i++)
+        {
+            int cell = getCellIndex(gridPositions[i]);
+            particleCell[i] = cell;
+            histogram[cell]++;
+        }
+    });
+
+    // particle totals of each thread's cell range
+    threadPool.parallelFor(numCells, [&](int begin, int end, int t)
+    {
+        int total = 0;
+        for (int c = begin; c < end; c++)
+        {
+            for (int h = 0; h < threads; h++)
+            {
+                total += cellHistogram[(size_t)h * numCells + c];
+            }
+        }
+        threadPartial[t + 1] = total;
+    });
+
+    threadPartial[0] = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        threadPartial[t + 1] += threadPartial[t];
+    }
+
+    // exclusive scan over (cell, thread), turning each histogram entry into the
+    // write offset of that thread inside that cell
+    threadPool.parallelFor(numCells, [&](int begin, int end, int t)
+    {
+        int offset = threadPartial[t];
+        for (int c = begin; c < end; c++)
+        {
+            cellStart[c] = offset;
+            for (int h = 0; h < threads; h++)
+            {
+                int &entry = cellHistogram[(size_t)h * numCells + c];
+                int count = entry;
+                entry = offset;
+                offset += count;
+            }
+        }
+    });
+    cellStart[numCells] = numParticles;
+
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+    {
+        int *offsets = &cellHistogram[(size_t)t * numCells];
+        for (int i = begin; i < end; i++)
+        {
+            int k = offsets[particleCell[i]]++;
+            glm::vec2 pos = gridPositions[i];
+            cellParticles[k] = i;
+            sortedX[k] = pos.x;
+            sortedY[k] = pos.y;
+        }
+    });
+
+    threadPool.parallelFor(numParticles - 1, [&](int begin, int end, int t)
+    {
+        int scattered = 0;
+        for (int k = begin + 1; k < end + 1; k++)
+        {
+            if (cellParticles[k] != cellParticles[k - 1] + 1)
+                scattered++;
+        }
+        threadPartial[t] = scattered;
+    });
+
+    int scattered = 0;
+    if (numParticles > 1)
+    {
+        for (int t = 0; t < threads; t++)
+        {
+            scattered += threadPartial[t];
+        }
+    }
+    gridDisorder = numParticles > 1 ? (float)scattered / (numParticles - 1) : 0.0f;
+}
+
+void Particle::gatherSortedFields()
+{
+    bool symmetric = pressureFormulation == PressureFormulation::Symmetric;
+    const AlignedBuffer<float> &terms = symmetric ? pressureOverDensitySq : pressures;
+
+    sortedPressureTerm.reserve(numParticles + kSimdLanes);
+    sortedInverseDensity.reserve(numParticles + kSimdLanes);
+    sortedPressureTerm.resize(numParticles);
+    sortedInverseDensity.resize(numParticles);
+
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int i = cellParticles[k];
+            sortedPressureTerm[k] = terms[i];
+            sortedInverseDensity[k] = inverseDensities[i];
+        }
+    });
+}
+
+void Particle::resetParticleIds()
+{
+    freeIds.clear();
+    particleId.resize(numParticles);
+    particleIndex.resize(numParticles);
     for (int i = 0; i < numParticles; i++)
     {
-        pressures[i] = convertDensityToPressure(densities[i]);
+        particleId[i] = i;
+        particleIndex[i] = i;
     }
 }
 
-int Particle::getCellHash(glm::vec2 position)
+// spreads the low 16 bits of v over the even bits of the result
+static unsigned int spreadBits(unsigned int v)
 {
-    int cellX = static_cast<int>(position.x / cellSize);
-    int cellY = static_cast<int>(position.y / cellSize);
-    return getCellHash(cellX, cellY);
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
 }
 
-int Particle::getCellHash(int x, int y)
+// new[k] = old[order[k]], arrays that are not sized yet are left alone
+template <typename T>
+static void permute(AlignedBuffer<T> &values, AlignedBuffer<T> &scratch, const AlignedBuffer<int> &order, int count)
 {
-    const int prime1 = 73856093;
-    const int prime2 = 19349663;
-    return (x * prime1) ^ (y * prime2);
+    if ((int)values.size() < count)
+        return;
+
+    scratch.resize(count);
+    for (int k = 0; k < count; k++)
+    {
+        scratch[k] = values[order[k]];
+    }
+    std::copy(scratch.begin(), scratch.end(), values.begin());
 }
 
-void Particle::buildSpatialGrid(std::vector<glm::vec2> predictedPos)
+static void permute(Vec2Array &values, Vec2Array &scratch, const AlignedBuffer<int> &order, int count)
 {
-    spatialGrid.clear();
-    cellSize = smoothingRadius;
-    for (int i = 0; i < numParticles; i++)
+    scratch.resize(count);
+    for (int k = 0; k < count; k++)
     {
-        int hash = getCellHash(predictedPos[i]);
-        spatialGrid[hash].push_back(i);
+        scratch.set(k, values[order[k]]);
     }
+    values.swap(scratch);
 }
 
+void Particle::reorderParticles()
+{
+    framesSinceReorder = 0;
+    if (gridCols == 0)
+        return;
+
+    reorderKeys.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+    {
+        unsigned int cx = getCellX(position[i].x);
+        unsigned int cy = getCellY(position[i].y);
+        unsigned long long morton = spreadBits(cx) | (spreadBits(cy) << 1);
+        reorderKeys[i] = (morton << 32) | (unsigned int)i;
+    }
+    std::sort(reorderKeys.begin(), reorderKeys.end());
+
+    reorderOrder.resize(numParticles);
+    for (int k = 0; k < numParticles; k++)
+    {
+        reorderOrder[k] = (int)(reorderKeys[k] & 0xffffffffu);
+    }
+
+    permute(position, reorderScratchVec2, reorderOrder, numParticles);
+    permute(previousPosition, reorderScratchVec2, reorderOrder, numParticles);
+    permute(velocite, reorderScratchVec2, reorderOrder, numParticles);
+    permute(predictedPosition, reorderScratchVec2, reorderOrder, numParticles);
+    permute(properties, reorderScratchFloat, reorderOrder, numParticles);
+    permute(densities, reorderScratchFloat, reorderOrder, numParticles);
+    permute(pressures, reorderScratchFloat, reorderOrder, numParticles);
+    permute(inverseDensities, reorderScratchFloat, reorderOrder, numParticles);
+    permute(pressureOverDensitySq, reorderScratchFloat, reorderOrder, numParticles);
+    permute(speed, reorderScratchFloat, reorderOrder, numParticles);
+    permute(particleId, reorderScratchInt, reorderOrder, numParticles);
+
+    for (int i = 0; i < numParticles; i++)
+    {
+        particleIndex[particleId[i]] = i;
+    }
+
+    // grid and neighbor list still refer to the old indices
+    neighborListDirty = true;
+    reorderCount++;
+}
 
-std::vector<int> Particle::getNeighbors(glm::vec2 samplePoint)
+void Particle::updateNeighborList()
 {
-    std::vector<int> neighbors;
+    neighborListSubsteps++;
 
-    int centerCellX = static_cast<int>(samplePoint.x / cellSize);
-    int centerCellY = static_cast<int>(samplePoint.y / cellSize);
+    if (!useVerletList || neighborListExpired())
+    {
+        buildSpatialGrid(predictedPosition);
+        buildNeighborList();
+    }
+    else
+    {
+        refreshNeighborList();
+    }
+}
 
-    for (int dx = -1; dx <= 1; dx++)
+bool Particle::neighborListExpired()
+{
+    if (neighborListDirty || neighborBuildRadius != neighborSearchRadius() ||
+        neighborBuildHalf != useHalfNeighborList ||
+        (int)neighborBuildPosition.size() != numParticles)
+        return true;
+
+    // two particles closing in on each other can each use up half the skin
+    float limit = 0.5f * neighborSkin;
+    float limitSq = limit * limit;
+    std::atomic<bool> expired(false);
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
     {
-        for (int dy = -1; dy <= 1; dy++)
+        for (int i = begin; i < end && !expired.load(std::memory_order_relaxed); i++)
         {
-            int cellX = centerCellX + dx;
-            int cellY = centerCellY + dy;
-            int hash = getCellHash(cellX, cellY);
+            glm::vec2 d = predictedPosition[i] - neighborBuildPosition[i];
+            if (glm::dot(d, d) > limitSq)
+                expired.store(true, std::memory_order_relaxed);
+        }
+    });
+    return expired.load();
+}
 
-            if (spatialGrid.find(hash) != spatialGrid.end())
+void Particle::buildNeighborList()
+{
+    float searchRadius = neighborSearchRadius();
+    float searchRadiusSq = searchRadius * searchRadius;
+    neighborListBuilds++;
+    neighborListDirty = false;
+    neighborBuildRadius = searchRadius;
+    neighborBuildHalf = useHalfNeighborList;
+    neighborBuildPosition = predictedPosition;
+
+    // one scan of the grid: each thread appends the pairs of its chunk to a chain
+    // of fixed-size blocks taken from a shared pool, reading the cell-sorted
+    // position copies the grid build left, and the chains are copied into place
+    // once the offsets are known. The pairs come out in forEachNeighbor order with
+    // the same squared distances, so the cached passes add exactly what the direct
+    // ones do. The pool is planned with the list; if the scene outgrows it, it
+    // doubles on the heap and the scan runs again
+    int threads = threadPool.getThreadCount();
+    neighborStart.resize(numParticles + 1);
+    threadBlockHead.resize(threads);
+    while (true)
+    {
+        // the pool is used by capacity, so its pages are only touched when filled
+        int blockCount = (int)std::min(neighborBlockNext.capacity(),
+                                       neighborBlockIndex.capacity() / kNeighborBlockPairs);
+        std::atomic<int> nextBlock(0);
+        std::atomic<bool> outOfBlocks(false);
+
+        threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+        {
+            int head = -1;
+            int block = -1;
+            int used = kNeighborBlockPairs;
+            bool full = false;
+
+            for (int i = begin; i < end && !full; i++)
             {
-                for (int particleIndex : spatialGrid[hash])
+                glm::vec2 samplePoint = predictedPosition[i];
+                int count = 0;
+                forEachCellRun(samplePoint, [&](int runBegin, int runEnd)
                 {
-                    if (particleIndex >= 0 && particleIndex < predictedPosition.size())
+                    for (int k = runBegin; k < runEnd && !full; k++)
                     {
-                        float distance = glm::length(predictedPosition[particleIndex] - samplePoint);
-                        if (distance < smoothingRadius)
+                        int j = cellParticles[k];
+                        glm::vec2 vec = glm::vec2(sortedX[k], sortedY[k]) - samplePoint;
+                        float dst2 = glm::dot(vec, vec);
+                        if (dst2 >= searchRadiusSq || (useHalfNeighborList && j <= i))
+                            continue;
+
+                        if (used == kNeighborBlockPairs)
                         {
-                            neighbors.push_back(particleIndex);
+                            int next = nextBlock.fetch_add(1, std::memory_order_relaxed);
+                            if (next >= blockCount)
+                            {
+                                full = true;
+                                break;
+                            }
+                            if (block < 0)
+                                head = next;
+                            else
+                                neighborBlockNext[block] = next;
+                            block = next;
+                            used = 0;
                         }
+                        size_t slot = (size_t)block * kNeighborBlockPairs + used++;
+                        neighborBlockIndex[slot] = j;
+                        neighborBlockDistanceSq[slot] = dst2;
+                        count++;
                     }
-                }
+                });
+                neighborStart[i + 1] = count;
             }
-        }
+
+            threadBlockHead[t] = head;
+            if (full)
+                outOfBlocks.store(true, std::memory_order_relaxed);
+        });
+
+        if (!outOfBlocks.load())
+            break;
+
+        size_t grown = std::max<size_t>(2 * (size_t)blockCount, threads + 1);
+        neighborBlockNext.reserve(grown);
+        neighborBlockIndex.reserve(grown * kNeighborBlockPairs);
+        neighborBlockDistanceSq.reserve(grown * kNeighborBlockPairs);
     }
 
-    return neighbors;
+    neighborStart[0] = 0;
+    for (int i = 0; i < numParticles; i++)
+    {
+        neighborStart[i + 1] += neighborStart[i];
+    }
+
+    // resize() keeps capacity, so once the list has grown to the scene size
+    // rebuilding it does not allocate
+    int pairCount = neighborStart[numParticles];
+    neighborIndex.resize(pairCount);
+    neighborDistanceSq.resize(pairCount);
+
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int t)
+    {
+        int k = neighborStart[begin];
+        int remaining = neighborStart[end] - k;
+        for (int block = threadBlockHead[t]; remaining > 0; block = neighborBlockNext[block])
+        {
+            int n = std::min(remaining, kNeighborBlockPairs);
+            size_t first = (size_t)block * kNeighborBlockPairs;
+            std::memcpy(&neighborIndex[k], &neighborBlockIndex[first], n * sizeof(int));
+            std::memcpy(&neighborDistanceSq[k], &neighborBlockDistanceSq[first], n * sizeof(float));
+            k += n;
+            remaining -= n;
+        }
+    });
 }
 
+// pairs keep their slots between Verlet rebuilds, only the squared distances
+// are recomputed from the new predicted positions
+void Particle::refreshNeighborList()
+{
+    threadPool.parallelFor(numParticles, [&](int begin, int end, int)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            glm::vec2 samplePoint = predictedPosition[i];
+
+            for (int k = neighborStart[i]; k < neighborStart[i + 1]; k++)
+            {
+                glm::vec2 vec = predictedPosition[neighborIndex[k]] - samplePoint;
+                neighborDistanceSq[k] = glm::dot(vec, vec);
+            }
+        }
+    });
+}
+
+void Particle::reserveCapacity(int particles)
+{
+    particleCapacity = std::max(particles, numParticles);
+    size_t capacity = particleCapacity;
+    // the vector kernels may load a full register past the last particle
+    size_t padded = capacity + kSimdLanes;
+    size_t pairs = capacity * std::max(neighborsPerParticle, 0);
+
+    // planned for the current smoothing radius and thread count; if either grows
+    // later, the buffers that depend on it move to the heap
+    resizeGrid();
+    int threads = threadPool.getThreadCount();
+    size_t cells = (size_t)gridCols * gridRows + 1;
+    size_t histogram = (size_t)threads * cells;
+    // every thread leaves at most one block partly filled
+    size_t blocks = (pairs + kNeighborBlockPairs - 1) / kNeighborBlockPairs + threads;
+
+    // laid out twice: once to size the arena, once to move every buffer into it
+    auto layout = [&](auto &&place)
+    {
+        place(position, capacity);
+        place(previousPosition, capacity);
+        place(velocite, capacity);
+        place(predictedPosition, capacity);
+        place(neighborBuildPosition, capacity);
+        place(reorderScratchVec2, capacity);
+        place(pressureSums, capacity);
+
+        place(densities, capacity);
+        place(pressures, capacity);
+        place(inverseDensities, capacity);
+        place(pressureOverDensitySq, capacity);
+        place(properties, capacity);
+        place(speed, capacity);
+        place(reorderScratchFloat, capacity);
+        place(sortedX, padded);
+        place(sortedY, padded);
+        place(sortedPressureTerm, padded);
+        place(sortedInverseDensity, padded);
+
+        place(particleId, capacity);
+        place(particleIndex, capacity);
+        place(freeIds, capacity);
+        place(particleCell, capacity);
+        place(cellParticles, capacity);
+        place(reorderOrder, capacity);
+        place(reorderScratchInt, capacity);
+        place(reorderKeys, capacity);
+        place(cellStart, cells);
+        place(cellHistogram, histogram);
+        place(threadPartial, threads + 1);
+        place(threadMaxSpeedSq, threads);
+        place(threadMaxAccelerationSq, threads);
+
+        place(neighborStart, capacity + 1);
+        place(neighborIndex, pairs);
+        place(neighborDistanceSq, pairs);
+        place(neighborBlockIndex, blocks * kNeighborBlockPairs);
+        place(neighborBlockDistanceSq, blocks * kNeighborBlockPairs);
+        place(neighborBlockNext, blocks);
+        place(threadBlockHead, threads);
+        place(spillPairs, pairs);
+        place(densitySpillValues, pairs);
+        place(pressureSpillValues, pairs);
+        place(spillStart, (size_t)threads * threads);
+        place(spillEnd, (size_t)threads * threads);
+    };
+
+    size_t bytes = 0;
+    layout([&](auto &buffer, size_t n)
+    { bytes += buffer.blockBytes(n); });
+
+    // the old arena goes only after every buffer has moved out of it
+    std::unique_ptr<Arena> grown = std::make_unique<Arena>(bytes);
+    layout([&](auto &buffer, size_t n)
+    { buffer.rehome(grown.get(), n); });
+    arena = std::move(grown);
+}
+
+size_t Particle::neighborCacheBytes() const
+{
+    return neighborBuildPosition.bytes() +
+           neighborStart.capacity() * sizeof(int) +
+           neighborIndex.capacity() * sizeof(int) +
+           neighborDistanceSq.capacity() * sizeof(float) +
+           neighborBlockIndex.capacity() * sizeof(int) +
+           neighborBlockDistanceSq.capacity() * sizeof(float) +
+           neighborBlockNext.capacity() * sizeof(int);
+}
 
 void Particle::applyMousePressure(glm::vec2 mousePos, float pressureStrength, float radius)
 {
@@ -431,12 +1377,12 @@ void Particle::applyMousePressure(glm::vec2 mousePos, float pressureStrength, fl
             if (pressureStrength > 0)
             {
 
-                velocite[i] += direction * pressureStrength * forceFactor;
+                velocite.add(i, direction * pressureStrength * forceFactor);
             }
             else
             {
 
-                velocite[i] -= direction * abs(pressureStrength) * forceFactor;
+                velocite.add(i, -direction * abs(pressureStrength) * forceFactor);
             }
         }
     }
@@ -0,0 +1,96 @@
+#include "Profiler.h"
+#include <algorithm>
+
+const char *profilePhaseName(ProfilePhase phase)
+{
+    switch (phase)
+    {
+    case ProfilePhase::Grid:
+        return "grid";
+    case ProfilePhase::NeighborList:
+        return "neighbor list";
+    case ProfilePhase::Density:
+        return "density";
+    case ProfilePhase::Pressure:
+        return "pressure";
+    case ProfilePhase::Integrate:
+        return "integrate";
+    case ProfilePhase::Boundaries:
+        return "boundaries";
+    case ProfilePhase::Step:
+        return "step";
+    case ProfilePhase::Colors:
+        return "colors";
+    case ProfilePhase::Upload:
+        return "upload";
+    case ProfilePhase::Draw:
+        return "draw";
+    case ProfilePhase::Gui:
+        return "gui";
+    case ProfilePhase::Swap:
+        return "swap";
+    default:
+        return "?";
+    }
+}
+
+void Profiler::endFrame()
+{
+    for (Track &track : tracks)
+    {
+        if (!track.touched)
+            continue;
+
+        track.history[track.next] = (float)(track.current * 1000.0);
+        track.next = (track.next + 1) % kHistory;
+        track.frames++;
+        track.total += track.current;
+        track.current = 0.0;
+        track.touched = false;
+    }
+}
+
+void Profiler::reset()
+{
+    for (Track &track : tracks)
+    {
+        track = Track();
+    }
+}
+
+// nearest-rank percentile of an ascending array
+static float percentile(const float *sorted, int count, float fraction)
+{
+    int rank = (int)(fraction * count + 0.999999f);
+    return sorted[std::clamp(rank, 1, count) - 1];
+}
+
+PhaseStats Profiler::stats(ProfilePhase phase) const
+{
+    const Track &track = tracks[(int)phase];
+    PhaseStats result;
+    result.total = track.total;
+    result.frames = track.frames;
+
+    int count = (int)std::min<long long>(track.frames, kHistory);
+    if (count == 0)
+        return result;
+
+    float sorted[kHistory];
+    std::copy(track.history, track.history + count, sorted);
+    std::sort(sorted, sorted + count);
+
+    float sum = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        sum += sorted[i];
+    }
+
+    result.last = track.history[(track.next + kHistory - 1) % kHistory];
+    result.average = sum / count;
+    result.p50 = percentile(sorted, count, 0.50f);
+    result.p95 = percentile(sorted, count, 0.95f);
+    result.p99 = percentile(sorted, count, 0.99f);
+    result.max = sorted[count - 1];
+    return result;
+}
@@ -0,0 +1,512 @@
+#include "Recorder.h"
+#include "Particle.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+static const float kFixedPointScale = 65535.0f;
+
+void RecordedFrame::resize(int n)
+{
+    ids.resize(n);
+    x.resize(n);
+    y.resize(n);
+    vx.resize(n);
+    vy.resize(n);
+    density.resize(n);
+}
+
+// stream 1..5 of a frame, in file order after the ids
+static std::vector<float> &floatStream(RecordedFrame &frame, int stream)
+{
+    switch (stream)
+    {
+    case 1:
+        return frame.x;
+    case 2:
+        return frame.y;
+    case 3:
+        return frame.vx;
+    case 4:
+        return frame.vy;
+    default:
+        return frame.density;
+    }
+}
+
+static const std::vector<float> &floatStream(const RecordedFrame &frame, int stream)
+{
+    return floatStream(const_cast<RecordedFrame &>(frame), stream);
+}
+
+static uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bitsFloat(uint32_t bits)
+{
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32_t zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+static int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+
+static void putVarint(std::vector<uint8_t> &out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static bool getVarint(const uint8_t *&in, const uint8_t *end, uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void putFixed(std::vector<uint8_t> &out, uint32_t value, int bytes)
+{
+    for (int b = 0; b < bytes; b++)
+    {
+        out.push_back((uint8_t)(value >> (8 * b)));
+    }
+}
+
+static bool getFixed(const uint8_t *&in, const uint8_t *end, uint32_t &value, int bytes)
+{
+    if (end - in < bytes)
+        return false;
+    value = 0;
+    for (int b = 0; b < bytes; b++)
+    {
+        value |= (uint32_t)*in++ << (8 * b);
+    }
+    return true;
+}
+
+// the value stored for element i of a stream, before the compression transform
+static uint32_t storedValue(const RecordedFrame &frame, const RecordingChunk &chunk, uint32_t flags, int stream, int i)
+{
+    if (stream == 0)
+        return (uint32_t)frame.ids[i];
+
+    float value = floatStream(frame, stream)[i];
+    if (!(flags & kRecordingQuantized))
+        return floatBits(value);
+
+    float low = chunk.low[stream];
+    float range = chunk.high[stream] - low;
+    float t = range > 0.0f ? (value - low) / range : 0.0f;
+    return (uint32_t)std::lround(std::min(std::max(t, 0.0f), 1.0f) * kFixedPointScale);
+}
+
+static void encodeFrame(const RecordedFrame &frame, const RecordingChunk &chunk, uint32_t flags,
+                        std::vector<uint8_t> &out)
+{
+    out.clear();
+    bool quantized = (flags & kRecordingQuantized) != 0;
+    for (int stream = 0; stream < kRecordingStreams; stream++)
+    {
+        bool fixedPoint = quantized && stream > 0;
+        uint32_t previous = 0;
+        for (int i = 0; i < frame.particles(); i++)
+        {
+            uint32_t value = storedValue(frame, chunk, flags, stream, i);
+            if (!(flags & kRecordingCompressed))
+            {
+                putFixed(out, value, fixedPoint ? 2 : 4);
+                continue;
+            }
+            // neighbors in memory are neighbors in space after a reorder, and ids
+            // mostly run in order, so the difference to the previous value is small
+            if (stream == 0 || fixedPoint)
+                putVarint(out, zigzag((int32_t)(value - previous)));
+            else
+                putVarint(out, value ^ previous);
+            previous = value;
+        }
+    }
+}
+
+static bool decodeFrame(const uint8_t *in, const uint8_t *end, const RecordingChunk &chunk, uint32_t flags,
+                        RecordedFrame &frame)
+{
+    frame.step = chunk.step;
+    frame.resize((int)chunk.particles);
+    bool quantized = (flags & kRecordingQuantized) != 0;
+    for (int stream = 0; stream < kRecordingStreams; stream++)
+    {
+        bool fixedPoint = quantized && stream > 0;
+        uint32_t previous = 0;
+        for (int i = 0; i < frame.particles(); i++)
+        {
+            uint32_t value;
+            if (!(flags & kRecordingCompressed))
+            {
+                if (!getFixed(in, end, value, fixedPoint ? 2 : 4))
+                    return false;
+            }
+            else
+            {
+                if (!getVarint(in, end, value))
+                    return false;
+                if (stream == 0 || fixedPoint)
+                    value = previous + (uint32_t)unzigzag(value);
+                else
+                    value ^= previous;
+                previous = value;
+            }
+
+            if (stream == 0)
+                frame.ids[i] = (int32_t)value;
+            else if (fixedPoint)
+                floatStream(frame, stream)[i] =
+                    chunk.low[stream] + value / kFixedPointScale * (chunk.high[stream] - chunk.low[stream]);
+            else
+                floatStream(frame, stream)[i] = bitsFloat(value);
+        }
+    }
+    return in == end;
+}
+
+bool FrameRecorder::open(const char *path, const Particle &p, const RecorderOptions &recorderOptions)
+{
+    close();
+
+    file = std::fopen(path, "wb");
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not write recording " << path << std::endl;
+        return false;
+    }
+
+    options = recorderOptions;
+    options.every = std::max(options.every, 1);
+    options.queueFrames = std::max(options.queueFrames, 1);
+
+    glm::vec2 half = p.GetDomainHalfSize();
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kRecordingMagic, sizeof(header.magic));
+    header.version = kRecordingVersion;
+    header.flags = (options.quantize ? kRecordingQuantized : 0) | (options.compress ? kRecordingCompressed : 0);
+    header.every = (uint32_t)options.every;
+    header.headerBytes = sizeof(RecordingHeader);
+    header.domainMin[0] = -half.x;
+    header.domainMin[1] = -half.y;
+    header.domainMax[0] = half.x;
+    header.domainMax[1] = half.y;
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    // frames are sized for the solver's capacity up front, so capturing does not
+    // allocate unless the scene outgrows it
+    pool.assign(options.queueFrames, RecordedFrame());
+    freeFrames.clear();
+    for (RecordedFrame &frame : pool)
+    {
+        frame.resize(p.getCapacity());
+        frame.resize(0);
+        freeFrames.push_back(&frame);
+    }
+    queued.clear();
+    index.clear();
+    recorded = 0;
+    droppedCount = 0;
+    stallCount = 0;
+    raw = 0;
+    written = sizeof(header);
+    closing = false;
+    failed = false;
+
+    writer = std::thread(&FrameRecorder::writerLoop, this);
+    return true;
+}
+
+void FrameRecorder::capture(const Particle &p, long long step)
+{
+    if (!file || step % options.every != 0)
+        return;
+
+    RecordedFrame *frame;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (failed)
+            return;
+        if (freeFrames.empty())
+        {
+            if (!options.blockWhenFull)
+            {
+                droppedCount++;
+                return;
+            }
+            stallCount++;
+            frameFree.wait(lock, [&]
+                           { return !freeFrames.empty(); });
+        }
+        frame = freeFrames.back();
+        freeFrames.pop_back();
+    }
+
+    int n = p.numParticles;
+    const Vec2Array &positions = p.GetPositions();
+    const Vec2Array &velocities = p.GetVelocities();
+    frame->step = step;
+    frame->resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        glm::vec2 pos = positions[i];
+        glm::vec2 vel = velocities[i];
+        frame->ids[i] = p.GetParticleId(i);
+        frame->x[i] = pos.x;
+        frame->y[i] = pos.y;
+        frame->vx[i] = vel.x;
+        frame->vy[i] = vel.y;
+        frame->density[i] = p.densities[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back(frame);
+        recorded++;
+    }
+    frameReady.notify_one();
+}
+
+void FrameRecorder::writerLoop()
+{
+    while (true)
+    {
+        RecordedFrame *frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameReady.wait(lock, [&]
+                            { return !queued.empty() || closing; });
+            if (queued.empty())
+                return;
+            frame = queued.front();
+            queued.pop_front();
+        }
+
+        bool ok = !failed && writeFrame(*frame);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ok && !failed)
+            {
+                failed = true;
+                std::cerr << "ERROR: Could not write recording frame " << frame->step << std::endl;
+            }
+            freeFrames.push_back(frame);
+        }
+        frameFree.notify_one();
+    }
+}
+
+bool FrameRecorder::writeFrame(const RecordedFrame &frame)
+{
+    RecordingChunk chunk;
+    std::memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = kRecordingChunkMagic;
+    chunk.particles = (uint32_t)frame.particles();
+    chunk.step = frame.step;
+
+    if (header.flags & kRecordingQuantized)
+    {
+        // positions over the domain, so the fixed point step is the same in every
+        // frame; the other fields over their own range in this frame
+        for (int stream = 1; stream < kRecordingStreams; stream++)
+        {
+            const std::vector<float> &values = floatStream(frame, stream);
+            if (stream <= 2)
+            {
+                chunk.low[stream] = header.domainMin[stream - 1];
+                chunk.high[stream] = header.domainMax[stream - 1];
+            }
+            else if (!values.empty())
+            {
+                auto range = std::minmax_element(values.begin(), values.end());
+                chunk.low[stream] = *range.first;
+                chunk.high[stream] = *range.second;
+            }
+        }
+    }
+
+    encodeFrame(frame, chunk, header.flags, payload);
+    chunk.payloadBytes = payload.size();
+
+    long offset = std::ftell(file);
+    if (offset < 0 || std::fwrite(&chunk, sizeof(chunk), 1, file) != 1 ||
+        std::fwrite(payload.data(), 1, payload.size(), file) != payload.size())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    index.push_back({frame.step, (uint64_t)offset});
+    raw += (unsigned long long)frame.particles() * (sizeof(int32_t) + 5 * sizeof(float));
+    written += sizeof(chunk) + payload.size();
+    return true;
+}
+
+bool FrameRecorder::close()
+{
+    if (!file)
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    frameReady.notify_one();
+    writer.join();
+
+    bool ok = !failed;
+    long indexOffset = std::ftell(file);
+    RecordingTrailer trailer;
+    std::memset(&trailer, 0, sizeof(trailer));
+    trailer.indexOffset = (uint64_t)indexOffset;
+    trailer.frameCount = index.size();
+    std::memcpy(trailer.magic, kRecordingMagic, sizeof(trailer.magic));
+    ok = ok && indexOffset >= 0 &&
+         std::fwrite(index.data(), sizeof(RecordingIndexEntry), index.size(), file) == index.size() &&
+         std::fwrite(&trailer, sizeof(trailer), 1, file) == 1;
+    written += index.size() * sizeof(RecordingIndexEntry) + sizeof(trailer);
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+
+    if (!ok)
+        std::cerr << "ERROR: Could not finish the recording" << std::endl;
+    return ok;
+}
+
+unsigned long long FrameRecorder::rawBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return raw;
+}
+
+unsigned long long FrameRecorder::writtenBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+FrameReader::~FrameReader()
+{
+    if (file)
+        std::fclose(file);
+}
+
+bool FrameReader::open(const char *path)
+{
+    if (file)
+        std::fclose(file);
+    index.clear();
+
+    file = std::fopen(path, "rb");
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not open recording " << path << std::endl;
+        return false;
+    }
+
+    RecordingTrailer trailer;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, kRecordingMagic, sizeof(header.magic)) != 0 ||
+        header.version != kRecordingVersion || header.headerBytes != sizeof(RecordingHeader))
+    {
+        std::cerr << "ERROR: " << path << ": not a recording, or an unsupported version" << std::endl;
+        return false;
+    }
+
+    long fileBytes = std::fseek(file, 0, SEEK_END) == 0 ? std::ftell(file) : -1;
+    if (fileBytes < 0)
+    {
+        std::cerr << "ERROR: Could not read recording " << path << std::endl;
+        return false;
+    }
+
+    bool indexed = fileBytes >= (long)(sizeof(header) + sizeof(trailer)) &&
+                   std::fseek(file, fileBytes - (long)sizeof(trailer), SEEK_SET) == 0 &&
+                   std::fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+                   std::memcmp(trailer.magic, kRecordingMagic, sizeof(trailer.magic)) == 0;
+    if (!indexed)
+    {
+        // the writer died before the index: every complete chunk up to the first
+        // torn one can still be found front to back
+        scanChunks((uint64_t)fileBytes);
+        std::cerr << path << ": no frame index, the recording was not closed; found " << index.size()
+                  << " frames" << std::endl;
+        return true;
+    }
+
+    // the index must fit between the header and the trailer before it is sized
+    uint64_t indexEnd = (uint64_t)fileBytes - sizeof(trailer);
+    if (trailer.indexOffset < sizeof(header) || trailer.indexOffset > indexEnd ||
+        trailer.frameCount > (indexEnd - trailer.indexOffset) / sizeof(RecordingIndexEntry))
+    {
+        std::cerr << "ERROR: " << path << ": corrupt frame index" << std::endl;
+        return false;
+    }
+
+    index.resize(trailer.frameCount);
+    if (std::fseek(file, (long)trailer.indexOffset, SEEK_SET) != 0 ||
+        std::fread(index.data(), sizeof(RecordingIndexEntry), index.size(), file) != index.size())
+    {
+        std::cerr << "ERROR: " << path << ": truncated frame index" << std::endl;
+        index.clear();
+        return false;
+    }
+    chunksEnd = trailer.indexOffset;
+    return true;
+}
+
+void FrameReader::scanChunks(uint64_t fileBytes)
+{
+    uint64_t offset = sizeof(header);
+    RecordingChunk chunk;
+    while (sizeof(chunk) <= fileBytes - offset && std::fseek(file, (long)offset, SEEK_SET) == 0 &&
+           std::fread(&chunk, sizeof(chunk), 1, file) == 1 && chunk.magic == kRecordingChunkMagic &&
+           chunk.payloadBytes <= fileBytes - offset - sizeof(chunk))
+    {
+        index.push_back({chunk.step, offset});
+        offset += sizeof(chunk) + chunk.payloadBytes;
+    }
+    chunksEnd = offset;
+}
+
+bool FrameReader::readFrame(int frame, RecordedFrame &out)
+{
+    if (!file || frame < 0 || frame >= frameCount())
+        return false;
+
+    uint64_t offset = index[frame].offset;
+    RecordingChunk chunk;
+    if (std::fseek(file, (long)offset, SEEK_SET) != 0 || std::fread(&chunk, sizeof(chunk), 1, file) != 1 ||
+        chunk.magic != kRecordingChunkMagic)
+        return false;
+
+    // a chunk may not reach past the last one, and every value takes at least a byte
+    if (offset > chunksEnd || sizeof(chunk) > chunksEnd - offset ||
+        chunk.payloadBytes > chunksEnd - offset - sizeof(chunk) ||
+        (uint64_t)chunk.particles * kRecordingStreams > chunk.payloadBytes)
+        return false;
+
+    payload.resize(chunk.payloadBytes);
+    if (std::fread(payload.data(), 1, payload.size(), file) != payload.size())
+        return false;
+    return decodeFrame(payload.data(), payload.data() + payload.size(), chunk, header.flags, out);
+}
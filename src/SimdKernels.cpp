@@ -0,0 +1,402 @@
+#include "SimdKernels.h"
+#include <immintrin.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+// Each ISA gets its own function compiled with a target attribute, so the rest of
+// the program keeps the default flags and the choice is made at runtime.
+
+static float densitySumScalar(const float *xs, const float *ys, int count,
+                              float px, float py, float sr2, float cutoff2)
+{
+    float sum = 0.0f;
+    for (int j = 0; j < count; j++)
+    {
+        float dx = xs[j] - px;
+        float dy = ys[j] - py;
+        float r2 = dx * dx + dy * dy;
+        if (r2 < cutoff2)
+        {
+            float diff = sr2 - r2;
+            sum += diff * diff * diff;
+        }
+    }
+    return sum;
+}
+
+// Paired is the shared-pressure form (t_i + t_j) * (s_i + s_j); without it the
+// pair term is (t_i + t_j) alone and ss is not read
+template <bool Paired>
+static glm::vec2 pressureSumScalarRun(const float *xs, const float *ys, const float *ts, const float *ss, int count,
+                                      float px, float py, float t, float s, float sr)
+{
+    glm::vec2 sum(0.0f);
+    float sr2 = sr * sr;
+    for (int j = 0; j < count; j++)
+    {
+        float dx = px - xs[j];
+        float dy = py - ys[j];
+        float r2 = dx * dx + dy * dy;
+        if (r2 > 0.0f && r2 < sr2)
+        {
+            float r = std::sqrt(r2);
+            float w = (sr - r) * (sr - r) / r * (t + ts[j]);
+            if (Paired)
+                w *= s + ss[j];
+            sum += w * glm::vec2(dx, dy);
+        }
+    }
+    return sum;
+}
+
+static glm::vec2 pressureSumScalar(const float *xs, const float *ys, const float *ts, const float *ss, int count,
+                                   float px, float py, float t, float s, float sr)
+{
+    return ss ? pressureSumScalarRun<true>(xs, ys, ts, ss, count, px, py, t, s, sr)
+              : pressureSumScalarRun<false>(xs, ys, ts, ss, count, px, py, t, s, sr);
+}
+
+__attribute__((target("sse4.1"))) static float horizontalSum128(__m128 v)
+{
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("sse4.1"))) static float densitySumSSE4(const float *xs, const float *ys, int count,
+                                                              float px, float py, float sr2, float cutoff2)
+{
+    __m128 vpx = _mm_set1_ps(px);
+    __m128 vpy = _mm_set1_ps(py);
+    __m128 vsr2 = _mm_set1_ps(sr2);
+    __m128 vcut = _mm_set1_ps(cutoff2);
+    __m128i vcount = _mm_set1_epi32(count);
+    __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    __m128 sum = _mm_setzero_ps();
+
+    for (int j = 0; j < count; j += 4)
+    {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + j), vpx);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + j), vpy);
+        __m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 diff = _mm_sub_ps(vsr2, r2);
+        __m128 cube = _mm_mul_ps(_mm_mul_ps(diff, diff), diff);
+
+        __m128i index = _mm_add_epi32(_mm_set1_epi32(j), lane);
+        __m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(vcount, index));
+        __m128 mask = _mm_and_ps(valid, _mm_cmplt_ps(r2, vcut));
+        sum = _mm_add_ps(sum, _mm_and_ps(mask, cube));
+    }
+    return horizontalSum128(sum);
+}
+
+template <bool Paired>
+__attribute__((target("sse4.1"))) static glm::vec2 pressureSumSSE4Run(const float *xs, const float *ys,
+                                                                      const float *ts, const float *ss, int count,
+                                                                      float px, float py, float t, float s, float sr)
+{
+    __m128 vpx = _mm_set1_ps(px);
+    __m128 vpy = _mm_set1_ps(py);
+    __m128 vsr = _mm_set1_ps(sr);
+    __m128 vsr2 = _mm_set1_ps(sr * sr);
+    __m128 vt = _mm_set1_ps(t);
+    __m128 vs = _mm_set1_ps(s);
+    __m128 zero = _mm_setzero_ps();
+    __m128i vcount = _mm_set1_epi32(count);
+    __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    __m128 sumX = _mm_setzero_ps();
+    __m128 sumY = _mm_setzero_ps();
+
+    for (int j = 0; j < count; j += 4)
+    {
+        __m128 dx = _mm_sub_ps(vpx, _mm_loadu_ps(xs + j));
+        __m128 dy = _mm_sub_ps(vpy, _mm_loadu_ps(ys + j));
+        __m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 r = _mm_sqrt_ps(r2);
+        __m128 falloff = _mm_sub_ps(vsr, r);
+
+        __m128 term = _mm_add_ps(vt, _mm_loadu_ps(ts + j));
+        if (Paired)
+            term = _mm_mul_ps(term, _mm_add_ps(vs, _mm_loadu_ps(ss + j)));
+        __m128 w = _mm_mul_ps(_mm_div_ps(_mm_mul_ps(falloff, falloff), r), term);
+
+        __m128i index = _mm_add_epi32(_mm_set1_epi32(j), lane);
+        __m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(vcount, index));
+        __m128 inRange = _mm_and_ps(_mm_cmpgt_ps(r2, zero), _mm_cmplt_ps(r2, vsr2));
+        w = _mm_and_ps(_mm_and_ps(valid, inRange), w);
+
+        sumX = _mm_add_ps(sumX, _mm_mul_ps(w, dx));
+        sumY = _mm_add_ps(sumY, _mm_mul_ps(w, dy));
+    }
+    return {horizontalSum128(sumX), horizontalSum128(sumY)};
+}
+
+static glm::vec2 pressureSumSSE4(const float *xs, const float *ys, const float *ts, const float *ss, int count,
+                                 float px, float py, float t, float s, float sr)
+{
+    return ss ? pressureSumSSE4Run<true>(xs, ys, ts, ss, count, px, py, t, s, sr)
+              : pressureSumSSE4Run<false>(xs, ys, ts, ss, count, px, py, t, s, sr);
+}
+
+__attribute__((target("avx2,fma"))) static float horizontalSum256(__m256 v)
+{
+    __m128 low = _mm256_castps256_ps128(v);
+    __m128 high = _mm256_extractf128_ps(v, 1);
+    __m128 sums = _mm_add_ps(low, high);
+    __m128 shuf = _mm_movehdup_ps(sums);
+    sums = _mm_add_ps(sums, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma"))) static float densitySumAVX2(const float *xs, const float *ys, int count,
+                                                                float px, float py, float sr2, float cutoff2)
+{
+    __m256 vpx = _mm256_set1_ps(px);
+    __m256 vpy = _mm256_set1_ps(py);
+    __m256 vsr2 = _mm256_set1_ps(sr2);
+    __m256 vcut = _mm256_set1_ps(cutoff2);
+    __m256i vcount = _mm256_set1_epi32(count);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 sum = _mm256_setzero_ps();
+
+    for (int j = 0; j < count; j += 8)
+    {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + j), vpx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + j), vpy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 diff = _mm256_sub_ps(vsr2, r2);
+        __m256 cube = _mm256_mul_ps(_mm256_mul_ps(diff, diff), diff);
+
+        __m256i index = _mm256_add_epi32(_mm256_set1_epi32(j), lane);
+        __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(vcount, index));
+        __m256 mask = _mm256_and_ps(valid, _mm256_cmp_ps(r2, vcut, _CMP_LT_OQ));
+        sum = _mm256_add_ps(sum, _mm256_and_ps(mask, cube));
+    }
+    return horizontalSum256(sum);
+}
+
+template <bool Paired>
+__attribute__((target("avx2,fma"))) static glm::vec2 pressureSumAVX2Run(const float *xs, const float *ys,
+                                                                        const float *ts, const float *ss, int count,
+                                                                        float px, float py, float t, float s, float sr)
+{
+    __m256 vpx = _mm256_set1_ps(px);
+    __m256 vpy = _mm256_set1_ps(py);
+    __m256 vsr = _mm256_set1_ps(sr);
+    __m256 vsr2 = _mm256_set1_ps(sr * sr);
+    __m256 vt = _mm256_set1_ps(t);
+    __m256 vs = _mm256_set1_ps(s);
+    __m256 zero = _mm256_setzero_ps();
+    __m256i vcount = _mm256_set1_epi32(count);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 sumX = _mm256_setzero_ps();
+    __m256 sumY = _mm256_setzero_ps();
+
+    for (int j = 0; j < count; j += 8)
+    {
+        __m256 dx = _mm256_sub_ps(vpx, _mm256_loadu_ps(xs + j));
+        __m256 dy = _mm256_sub_ps(vpy, _mm256_loadu_ps(ys + j));
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 r = _mm256_sqrt_ps(r2);
+        __m256 falloff = _mm256_sub_ps(vsr, r);
+
+        __m256 term = _mm256_add_ps(vt, _mm256_loadu_ps(ts + j));
+        if (Paired)
+            term = _mm256_mul_ps(term, _mm256_add_ps(vs, _mm256_loadu_ps(ss + j)));
+        __m256 w = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(falloff, falloff), r), term);
+
+        __m256i index = _mm256_add_epi32(_mm256_set1_epi32(j), lane);
+        __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(vcount, index));
+        __m256 inRange = _mm256_and_ps(_mm256_cmp_ps(r2, zero, _CMP_GT_OQ), _mm256_cmp_ps(r2, vsr2, _CMP_LT_OQ));
+        w = _mm256_and_ps(_mm256_and_ps(valid, inRange), w);
+
+        sumX = _mm256_fmadd_ps(w, dx, sumX);
+        sumY = _mm256_fmadd_ps(w, dy, sumY);
+    }
+    return {horizontalSum256(sumX), horizontalSum256(sumY)};
+}
+
+static glm::vec2 pressureSumAVX2(const float *xs, const float *ys, const float *ts, const float *ss, int count,
+                                 float px, float py, float t, float s, float sr)
+{
+    return ss ? pressureSumAVX2Run<true>(xs, ys, ts, ss, count, px, py, t, s, sr)
+              : pressureSumAVX2Run<false>(xs, ys, ts, ss, count, px, py, t, s, sr);
+}
+
+__attribute__((target("avx512f"))) static float densitySumAVX512(const float *xs, const float *ys, int count,
+                                                                 float px, float py, float sr2, float cutoff2)
+{
+    __m512 vpx = _mm512_set1_ps(px);
+    __m512 vpy = _mm512_set1_ps(py);
+    __m512 vsr2 = _mm512_set1_ps(sr2);
+    __m512 vcut = _mm512_set1_ps(cutoff2);
+    __m512 sum = _mm512_setzero_ps();
+
+    for (int j = 0; j < count; j += 16)
+    {
+        int remaining = count - j;
+        __mmask16 valid = remaining >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << remaining) - 1);
+
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, xs + j), vpx);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, ys + j), vpy);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __m512 diff = _mm512_sub_ps(vsr2, r2);
+        __m512 cube = _mm512_mul_ps(_mm512_mul_ps(diff, diff), diff);
+
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, r2, vcut, _CMP_LT_OQ);
+        sum = _mm512_mask_add_ps(sum, mask, sum, cube);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+template <bool Paired>
+__attribute__((target("avx512f"))) static glm::vec2 pressureSumAVX512Run(const float *xs, const float *ys,
+                                                                         const float *ts, const float *ss, int count,
+                                                                         float px, float py, float t, float s, float sr)
+{
+    __m512 vpx = _mm512_set1_ps(px);
+    __m512 vpy = _mm512_set1_ps(py);
+    __m512 vsr = _mm512_set1_ps(sr);
+    __m512 vsr2 = _mm512_set1_ps(sr * sr);
+    __m512 vt = _mm512_set1_ps(t);
+    __m512 vs = _mm512_set1_ps(s);
+    __m512 zero = _mm512_setzero_ps();
+    __m512 sumX = _mm512_setzero_ps();
+    __m512 sumY = _mm512_setzero_ps();
+
+    for (int j = 0; j < count; j += 16)
+    {
+        int remaining = count - j;
+        __mmask16 valid = remaining >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << remaining) - 1);
+
+        __m512 dx = _mm512_sub_ps(vpx, _mm512_maskz_loadu_ps(valid, xs + j));
+        __m512 dy = _mm512_sub_ps(vpy, _mm512_maskz_loadu_ps(valid, ys + j));
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, r2, zero, _CMP_GT_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, r2, vsr2, _CMP_LT_OQ);
+
+        __m512 r = _mm512_sqrt_ps(r2);
+        __m512 falloff = _mm512_sub_ps(vsr, r);
+        __m512 term = _mm512_add_ps(vt, _mm512_maskz_loadu_ps(mask, ts + j));
+        if (Paired)
+            term = _mm512_mul_ps(term, _mm512_add_ps(vs, _mm512_maskz_loadu_ps(mask, ss + j)));
+        __m512 w = _mm512_mul_ps(_mm512_maskz_div_ps(mask, _mm512_mul_ps(falloff, falloff), r), term);
+
+        sumX = _mm512_mask3_fmadd_ps(w, dx, sumX, mask);
+        sumY = _mm512_mask3_fmadd_ps(w, dy, sumY, mask);
+    }
+    return {_mm512_reduce_add_ps(sumX), _mm512_reduce_add_ps(sumY)};
+}
+
+static glm::vec2 pressureSumAVX512(const float *xs, const float *ys, const float *ts, const float *ss, int count,
+                                   float px, float py, float t, float s, float sr)
+{
+    return ss ? pressureSumAVX512Run<true>(xs, ys, ts, ss, count, px, py, t, s, sr)
+              : pressureSumAVX512Run<false>(xs, ys, ts, ss, count, px, py, t, s, sr);
+}
+
+static SimdLevel queryCpu()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::SSE4;
+    return SimdLevel::Scalar;
+}
+
+SimdLevel detectSimdLevel()
+{
+    static const SimdLevel level = queryCpu();
+    return level;
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX512:
+        return "AVX-512";
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::SSE4:
+        return "SSE4";
+    default:
+        return "scalar";
+    }
+}
+
+SimdKernels getSimdKernels(SimdLevel level)
+{
+    level = std::min(level, detectSimdLevel());
+
+    switch (level)
+    {
+    case SimdLevel::AVX512:
+        return {level, densitySumAVX512, pressureSumAVX512};
+    case SimdLevel::AVX2:
+        return {level, densitySumAVX2, pressureSumAVX2};
+    case SimdLevel::SSE4:
+        return {level, densitySumSSE4, pressureSumSSE4};
+    default:
+        return {SimdLevel::Scalar, densitySumScalar, pressureSumScalar};
+    }
+}
+
+float checkSimdKernels(SimdLevel level)
+{
+    SimdKernels scalar = getSimdKernels(SimdLevel::Scalar);
+    SimdKernels vector = getSimdKernels(level);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coord(-0.3f, 0.3f);
+    std::uniform_real_distribution<float> value(0.5f, 4.0f);
+
+    // padded like the solver's sorted arrays so full-width loads stay in bounds
+    const int maxCount = 64;
+    std::vector<float> xs(maxCount + 16), ys(maxCount + 16), pressures(maxCount + 16), inverseDensities(maxCount + 16);
+    float sr = 0.17f;
+    float maxError = 0.0f;
+
+    for (int trial = 0; trial < 200; trial++)
+    {
+        int count = trial % (maxCount + 1);
+        for (int j = 0; j < maxCount + 16; j++)
+        {
+            xs[j] = coord(rng);
+            ys[j] = coord(rng);
+            pressures[j] = value(rng) - 2.0f;
+            inverseDensities[j] = 1.0f / value(rng);
+        }
+        // a coincident candidate must be skipped by the pressure kernel
+        if (count > 0)
+        {
+            xs[0] = 0.0f;
+            ys[0] = 0.0f;
+        }
+
+        float a = scalar.densitySum(xs.data(), ys.data(), count, 0.0f, 0.0f, sr * sr, sr * sr);
+        float b = vector.densitySum(xs.data(), ys.data(), count, 0.0f, 0.0f, sr * sr, sr * sr);
+        maxError = std::max(maxError, std::fabs(a - b) / std::max(std::fabs(a), 1e-12f));
+
+        // both the paired (shared pressure) and the single-term (symmetric) form
+        for (const float *ss : {(const float *)inverseDensities.data(), (const float *)nullptr})
+        {
+            glm::vec2 fa = scalar.pressureSum(xs.data(), ys.data(), pressures.data(), ss, count, 0.0f, 0.0f, 1.0f, 0.5f, sr);
+            glm::vec2 fb = vector.pressureSum(xs.data(), ys.data(), pressures.data(), ss, count, 0.0f, 0.0f, 1.0f, 0.5f, sr);
+            float scale = std::max(glm::length(fa), 1e-6f);
+            maxError = std::max(maxError, glm::length(fa - fb) / scale);
+        }
+    }
+
+    return maxError;
+}
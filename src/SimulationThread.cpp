@@ -0,0 +1,199 @@
+#include "SimulationThread.h"
+#include <algorithm>
+#include <cmath>
+
+using Clock = std::chrono::steady_clock;
+
+// longest the solver sleeps before looking at the command queue again
+static const float kMaxSleep = 0.004f;
+
+void SimulationThread::start(Particle *particle)
+{
+  stop();
+
+  p = particle;
+  accumulator = 0.0f;
+  quit.store(false);
+
+  // the render thread has a snapshot to draw before the solver publishes one
+  publish(1.0f / simRate.load(), Clock::now(), 0);
+  snapshots.update();
+
+  thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop(bool keepRecording)
+{
+  if (!thread.joinable())
+    return;
+
+  quit.store(true);
+  thread.join();
+
+  // commands that arrived after the last batch still apply, in order
+  Command command;
+  while (commands.pop(command))
+  {
+    command(*p);
+  }
+
+  if (recorder && !keepRecording)
+  {
+    recorder->close();
+    recorder.reset();
+  }
+}
+
+void SimulationThread::submit(Command command)
+{
+  // the solver drains the queue before every batch, so it is only full for a moment
+  while (!commands.push(std::move(command)))
+  {
+    std::this_thread::yield();
+  }
+}
+
+void SimulationThread::startRecording(const std::string &path, const RecorderOptions &options)
+{
+  submit([this, path, options](Particle &particle)
+         {
+           recorder = std::make_unique<FrameRecorder>();
+           if (!recorder->open(path.c_str(), particle, options))
+             recorder.reset();
+         });
+}
+
+void SimulationThread::stopRecording()
+{
+  submit([this](Particle &)
+         {
+           if (recorder)
+           {
+             recorder->close();
+             recorder.reset();
+           }
+         });
+}
+
+const SolverSnapshot &SimulationThread::latest()
+{
+  snapshots.update();
+  return snapshots.front();
+}
+
+void SimulationThread::run()
+{
+  Clock::time_point previous = Clock::now();
+  bool changed = false;
+
+  while (!quit.load())
+  {
+    Command command;
+    while (commands.pop(command))
+    {
+      command(*p);
+      changed = true;
+    }
+
+    Clock::time_point now = Clock::now();
+    float elapsed = std::chrono::duration<float>(now - previous).count();
+    previous = now;
+
+    // in adaptive mode each step is as long as the solver's CFL limit allows, so a
+    // calm scene takes one long step per batch instead of several fixed ones
+    auto nextStepDt = [&]()
+    { return p->useAdaptiveTimestep ? p->stableTimestep() : 1.0f / simRate.load(); };
+
+    float stepDt = nextStepDt();
+    int steps = 0;
+    int maxSteps = maxStepsPerBatch.load();
+
+    if (p->running)
+    {
+      accumulator += elapsed;
+      while (accumulator >= stepDt && steps < maxSteps)
+      {
+        p->update(stepDt);
+        stepCount++;
+        if (recorder)
+          recorder->capture(*p, stepCount);
+        accumulator -= stepDt;
+        steps++;
+        stepDt = nextStepDt();
+      }
+
+      // time beyond the cap is dropped so a slow batch cannot snowball
+      if (accumulator >= stepDt)
+      {
+        droppedSteps += (int)(accumulator / stepDt);
+        accumulator = std::fmod(accumulator, stepDt);
+      }
+    }
+    else
+    {
+      accumulator = 0.0f;
+    }
+
+    if (steps > 0 || changed)
+    {
+      publish(stepDt, now, steps);
+      changed = false;
+    }
+
+    // sleep until the next step is due, waking often enough for input
+    float wait = p->running ? std::min(stepDt - accumulator, kMaxSleep) : kMaxSleep;
+    if (wait > 0.0f)
+    {
+      std::this_thread::sleep_for(std::chrono::duration<float>(wait));
+    }
+  }
+}
+
+void SimulationThread::publish(float stepDt, Clock::time_point now, int steps)
+{
+  SolverSnapshot &snapshot = snapshots.back();
+
+  int count = p->GetPositions().size();
+  snapshot.count = count;
+  snapshot.positions.resize(count);
+  snapshot.previousPositions.resize(count);
+  p->interpolatePositions(1.0f, snapshot.positions.data());
+  p->interpolatePositions(0.0f, snapshot.previousPositions.data());
+  snapshot.speed = p->speed;
+  snapshot.densities = p->densities;
+  snapshot.pressures = p->pressures;
+
+  snapshot.running = p->running;
+  snapshot.accumulator = accumulator;
+  snapshot.stepDt = stepDt;
+  snapshot.published = now;
+
+  SolverStats &stats = snapshot.stats;
+  stats.numParticles = p->numParticles;
+  stats.capacity = p->getCapacity();
+  stats.particlesEmitted = p->particlesEmitted;
+  stats.particlesRemoved = p->particlesRemoved;
+  stats.neighborListBuilds = p->neighborListBuilds;
+  stats.neighborListSubsteps = p->neighborListSubsteps;
+  stats.neighborCacheBytes = p->neighborCacheBytes();
+  stats.neighborPairCount = p->neighborPairCount();
+  stats.gridDisorder = p->gridDisorder;
+  stats.reorderCount = p->reorderCount;
+  stats.arenaBytes = p->arenaBytes();
+  stats.arenaUsedBytes = p->arenaUsedBytes();
+  stats.arenaHugePages = p->arenaHugePages();
+  stats.lastSubstepDt = p->lastSubstepDt;
+  stats.lastSubsteps = p->lastSubsteps;
+  stats.maxSpeed = p->maxSpeed;
+  stats.maxAcceleration = p->maxAcceleration;
+  stats.stepsLastBatch = steps;
+  stats.droppedSteps = droppedSteps;
+  stats.recording = recorder != nullptr;
+  stats.framesRecorded = recorder ? recorder->framesRecorded() : 0;
+  stats.framesDropped = recorder ? recorder->framesDropped() : 0;
+  stats.recorderStalls = recorder ? recorder->stalls() : 0;
+
+  snapshot.profiler = p->profiler;
+
+  snapshots.publish();
+}
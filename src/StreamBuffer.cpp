@@ -0,0 +1,119 @@
+#include "StreamBuffer.h"
+
+const char *uploadModeName(UploadMode mode)
+{
+  return mode == UploadMode::Persistent ? "persistent" : "orphan";
+}
+
+void StreamBuffer::create(GLsizeiptr elementSize, int capacity, UploadMode mode)
+{
+  destroy();
+
+  elementBytes = elementSize;
+  regionCapacity = capacity > 0 ? capacity : 1;
+  uploadMode = mode == UploadMode::Persistent && GLAD_GL_VERSION_4_4 ? UploadMode::Persistent : UploadMode::Orphan;
+  region = 0;
+
+  glGenBuffers(1, &id);
+  glBindBuffer(GL_ARRAY_BUFFER, id);
+
+  if (uploadMode == UploadMode::Persistent)
+  {
+    // coherent, so writes are visible to the next draw without an explicit flush
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr bytes = kRegions * regionCapacity * elementBytes;
+    glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+    persistent = static_cast<char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+    if (persistent)
+      return;
+
+    // the driver advertises 4.4 but will not map the storage; start over with orphaning
+    glDeleteBuffers(1, &id);
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    uploadMode = UploadMode::Orphan;
+  }
+
+  glBufferData(GL_ARRAY_BUFFER, regionCapacity * elementBytes, nullptr, GL_STREAM_DRAW);
+}
+
+void StreamBuffer::destroy()
+{
+  for (GLsync &sync : fences)
+  {
+    if (sync)
+      glDeleteSync(sync);
+    sync = nullptr;
+  }
+
+  if (id)
+  {
+    if (persistent)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, id);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &id);
+  }
+  id = 0;
+  persistent = nullptr;
+}
+
+void *StreamBuffer::map(int count)
+{
+  if (count <= 0)
+    return nullptr;
+
+  if (uploadMode == UploadMode::Orphan)
+  {
+    // new storage for the buffer; the old one lives on until the GPU is done with it
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glBufferData(GL_ARRAY_BUFFER, regionCapacity * elementBytes, nullptr, GL_STREAM_DRAW);
+    void *memory = glMapBufferRange(GL_ARRAY_BUFFER, 0, count * elementBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    orphanMapped = memory != nullptr;
+    return memory;
+  }
+
+  region = (region + 1) % kRegions;
+  GLsync &sync = fences[region];
+  if (sync)
+  {
+    GLenum status = glClientWaitSync(sync, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+      stallCount++;
+      // flush once so the fence is guaranteed to be reached, then wait in 1 ms slices
+      GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+      do
+      {
+        status = glClientWaitSync(sync, flags, 1000000);
+        flags = 0;
+      } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(sync);
+    sync = nullptr;
+  }
+
+  return persistent + (GLsizeiptr)region * regionCapacity * elementBytes;
+}
+
+void StreamBuffer::unmap()
+{
+  if (orphanMapped)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    orphanMapped = false;
+  }
+}
+
+void StreamBuffer::fence()
+{
+  if (uploadMode != UploadMode::Persistent)
+    return;
+
+  GLsync &sync = fences[region];
+  if (sync)
+    glDeleteSync(sync);
+  sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
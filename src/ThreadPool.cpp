@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    setThreadCount(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopWorkers();
+}
+
+void ThreadPool::setThreadCount(int count)
+{
+    count = std::max(1, count);
+    if (count == threadCount && (int)workers.size() == count - 1)
+        return;
+
+    stopWorkers();
+    threadCount = count;
+    startWorkers();
+}
+
+void ThreadPool::startWorkers()
+{
+    stopping = false;
+    for (int t = 1; t < threadCount; t++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t, generation);
+    }
+}
+
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void ThreadPool::run(int count, Task fn, void *context)
+{
+    // an empty range still runs fn on every thread, so per-thread slots such as
+    // histogram rows get reset instead of keeping the previous pass's values
+    count = std::max(0, count);
+
+    if (threadCount == 1)
+    {
+        fn(context, 0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = fn;
+        taskContext = context;
+        taskCount = count;
+        pendingWorkers = threadCount - 1;
+        generation++;
+    }
+    wakeCondition.notify_all();
+
+    fn(context, 0, chunkBegin(count, 1), 0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]
+                       { return pendingWorkers == 0; });
+}
+
+void ThreadPool::workerLoop(int threadIndex, unsigned int startGeneration)
+{
+    unsigned int seenGeneration = startGeneration;
+
+    while (true)
+    {
+        Task fn;
+        void *context;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&]
+                               { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+
+            seenGeneration = generation;
+            fn = task;
+            context = taskContext;
+            count = taskCount;
+        }
+
+        fn(context, chunkBegin(count, threadIndex), chunkBegin(count, threadIndex + 1), threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingWorkers--;
+        }
+        doneCondition.notify_one();
+    }
+}
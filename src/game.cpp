@@ -5,21 +5,68 @@
 #include <iostream>
 #include <time.h>
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 
 #define UNITMULTIPLIER 100
 
+// upper end of the particle count slider
+static const int kMaxParticles = 3500;
+
 /*
   1 UNIT Is 100 pixels
   we only do this for rendering and not for calculation of physics
 */
 
 GLuint shaderProgram;
-GLuint VBO, VAO;
-GLuint colorVBO;
+GLuint VAO;
 
 int numOfParticels;
 
+// the blue, cyan, green, orange ramp particles have always been drawn with
+static glm::vec3 colormapColor(float t)
+{
+  if (t < 0.33f)
+  {
+    // blue to cyan
+    float localT = t * 3.0f;
+    return glm::vec3(0.0f, localT, 1.0f);
+  }
+  if (t < 0.66f)
+  {
+    // cyan to green
+    float localT = (t - 0.33f) * 3.0f;
+    return glm::vec3(0.0f, 1.0f, 1.0f - localT);
+  }
+  // green to orange
+  float localT = (t - 0.66f) * 3.0f;
+  return glm::vec3(localT, 1.0f - localT * 0.5f, 0.0f);
+}
+
+// the ramp sampled into a 1D texture the vertex shader looks scalars up in
+static GLuint createColormapTexture()
+{
+  const int texels = 256;
+  std::vector<glm::vec3> ramp(texels);
+  for (int i = 0; i < texels; i++)
+  {
+    ramp[i] = colormapColor(i / (texels - 1.0f));
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_1D, texture);
+  glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, texels, 0, GL_RGB, GL_FLOAT, ramp.data());
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_1D, 0);
+  return texture;
+}
+
 GLuint compileShader(GLenum type, const char *source)
 {
   GLuint shader = glCreateShader(type);
@@ -28,16 +75,74 @@ GLuint compileShader(GLenum type, const char *source)
   return shader;
 }
 
+SolverControls SolverControls::from(const Particle &p)
+{
+  SolverControls c;
+  c.gravity = p.GRAVITY;
+  c.radius = p.radius;
+  c.mass = p.mass;
+  c.alpha = p.alpha;
+  c.particleSpacing = p.particleSpacing;
+  c.smoothingRadius = p.smoothingRadius;
+  c.targetDensity = p.targetDensity;
+  c.pressureMultiplier = p.pressureMultiplier;
+  c.useSimdKernels = p.useSimdKernels;
+  c.simdLevel = p.simdLevel;
+  c.pressureFormulation = p.pressureFormulation;
+  c.useNeighborCache = p.useNeighborCache;
+  c.useVerletList = p.useVerletList;
+  c.useHalfNeighborList = p.useHalfNeighborList;
+  c.neighborSkin = p.neighborSkin;
+  c.useSpatialReorder = p.useSpatialReorder;
+  c.reorderInterval = p.reorderInterval;
+  c.reorderThreshold = p.reorderThreshold;
+  c.useAdaptiveTimestep = p.useAdaptiveTimestep;
+  c.cflNumber = p.cflNumber;
+  c.forceCflNumber = p.forceCflNumber;
+  c.substeps = p.substeps;
+  c.running = p.running;
+  return c;
+}
+
+void SolverControls::applyTo(Particle &p) const
+{
+  p.GRAVITY = gravity;
+  p.radius = radius;
+  p.mass = mass;
+  p.alpha = alpha;
+  p.particleSpacing = particleSpacing;
+  p.smoothingRadius = smoothingRadius;
+  p.recalculateSRConstant();
+  p.targetDensity = targetDensity;
+  p.pressureMultiplier = pressureMultiplier;
+  p.useSimdKernels = useSimdKernels;
+  p.simdLevel = simdLevel;
+  p.pressureFormulation = pressureFormulation;
+  p.useNeighborCache = useNeighborCache;
+  p.useVerletList = useVerletList;
+  p.useHalfNeighborList = useHalfNeighborList;
+  p.neighborSkin = neighborSkin;
+  p.useSpatialReorder = useSpatialReorder;
+  p.reorderInterval = reorderInterval;
+  p.reorderThreshold = reorderThreshold;
+  p.useAdaptiveTimestep = useAdaptiveTimestep;
+  p.cflNumber = cflNumber;
+  p.forceCflNumber = forceCflNumber;
+  p.substeps = substeps;
+  p.running = running;
+}
+
 Game::Game()
 {
   numOfParticels = 0;
-  previousNumParticles = 0;
+  leftMouseDown = false;
+  rightMouseDown = false;
   cameraPosition = {0.0f, 0.0f};
   cameraZoom = 1.0f;
   cameraSpeed = 0.5f;
 }
 
-bool Game::init(const char *title, int WINDOW_W, int WINDOW_H)
+bool Game::init(const char *title, int WINDOW_W, int WINDOW_H, int threads)
 {
   this->WINDOW_W = WINDOW_W;
   this->WINDOW_H = WINDOW_H;
@@ -65,37 +170,37 @@ bool Game::init(const char *title, int WINDOW_W, int WINDOW_H)
   glViewport(0, 0, WINDOW_W, WINDOW_H);
 
   p = new Particle(WINDOW_W, WINDOW_H);
+
+  // 0 picks one thread per hardware core
+  threadCount = threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+  p->setThreadCount(threadCount);
+  // plan the solver's arena for the largest scene the slider can ask for
+  p->reserveCapacity(kMaxParticles);
   ImguiInit();
 
   glEnable(GL_PROGRAM_POINT_SIZE);
   glEnable(GL_POINT_SPRITE);
 
   numOfParticels = p->GetPositions().size();
-  colors.resize(numOfParticels, glm::vec3(0.0f, 0.0f, 1.0f));
 
   glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-  glGenBuffers(1, &colorVBO);
-
-  glBindVertexArray(VAO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, numOfParticels * sizeof(glm::vec2), p->GetPositions().data(), GL_DYNAMIC_DRAW);
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)0);
-  glEnableVertexAttribArray(0);
-
-  glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-  glBufferData(GL_ARRAY_BUFFER, numOfParticels * sizeof(glm::vec3), colors.data(), GL_DYNAMIC_DRAW);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
-  glEnableVertexAttribArray(1);
-
-  glBindVertexArray(0);
+  growBuffers(std::max(numOfParticels, p->getCapacity()));
 
   shader = new Shader("shaders/vertex.vert", "shaders/fragment.frag");
+  colormapTexture = createColormapTexture();
+  shader->use();
+  shader->setInt("colormap", 0);
 
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // from here on the Particle belongs to the solver thread
+  controls = SolverControls::from(*p);
+  sceneParticles = p->numParticles;
+  pipes = !p->emitters.empty();
+  simulation.start(p);
+  snapshot = &simulation.latest();
+
   frameTimePrev = SDL_GetTicks();
   frameCount = 0;
   fps = 0.0f;
@@ -104,53 +209,88 @@ bool Game::init(const char *title, int WINDOW_W, int WINDOW_H)
   return true;
 }
 
-void Game::update(float dt)
+void Game::update(float frameDt)
 {
-  p->update(dt);
-  numOfParticels = p->GetPositions().size();
+  // the solver thread paces itself from its own clock
+  (void)frameDt;
+  simulation.simRate.store(simRate);
+  simulation.maxStepsPerBatch.store(maxStepsPerFrame);
 
-  if (numOfParticels != previousNumParticles || previousNumParticles == -1)
+  if (checkpointLoadPending)
   {
-    std::cout << "Particle count changed from " << previousNumParticles
-              << " to " << numOfParticels << std::endl;
-    recreateBuffers();
+    checkpointLoadPending = false;
+    loadCheckpoint();
   }
 
-  previousNumParticles = numOfParticels;
+  snapshot = &simulation.latest();
 
-  colors.resize(numOfParticels);
-  float maxSpeed = 5.0f;
+  // how far the display is past the snapshot's last step, in steps
+  float alpha = 1.0f;
+  if (snapshot->running)
+  {
+    float sincePublished = std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot->published).count();
+    alpha = std::min((snapshot->accumulator + sincePublished) / snapshot->stepDt, 1.0f);
+  }
 
-  for (int i = 0; i < numOfParticels; i++)
+  numOfParticels = snapshot->count;
+  if (numOfParticels > bufferCapacity)
   {
-    float t = glm::clamp(p->speed[i] / maxSpeed, 0.0f, 1.0f);
+    growBuffers(std::max(numOfParticels, 2 * bufferCapacity));
+  }
 
-    // blue to green
-    if (t < 0.33f)
-    {
-      // blue to cyan
-      float localT = t * 3.0f;
-      colors[i] = glm::vec3(0.0f, localT, 1.0f);
-    }
-    else if (t < 0.66f)
-    {
-      // cyan to green
-      float localT = (t - 0.33f) * 3.0f;
-      colors[i] = glm::vec3(0.0f, 1.0f, 1.0f - localT);
-    }
-    else
+  {
+    SPH_PROFILE_SCOPE(frameProfiler, Upload);
+    glm::vec2 *positions = static_cast<glm::vec2 *>(positionStream.map(numOfParticels));
+    if (positions)
     {
-      // green to orange
-      float localT = (t - 0.66f) * 3.0f;
-      colors[i] = glm::vec3(localT, 1.0f - localT * 0.5f, 0.0f);
+      const glm::vec2 *current = snapshot->positions.data();
+      const glm::vec2 *previous = snapshot->previousPositions.data();
+      for (int i = 0; i < numOfParticels; i++)
+      {
+        positions[i] = previous[i] + (current[i] - previous[i]) * alpha;
+      }
     }
+    positionStream.unmap();
+  }
+
+  // the shader turns the scalar into a color, so this is one float per particle
+  SPH_PROFILE_SCOPE(frameProfiler, Colors);
+  float *scalars = static_cast<float *>(scalarStream.map(numOfParticels));
+  if (scalars)
+  {
+    const AlignedBuffer<float> &field = colorFieldValues();
+    // pressures are only filled by a solver step, so a paused resize can leave them short
+    int available = std::min(numOfParticels, (int)field.size());
+    std::copy(field.data(), field.data() + available, scalars);
+    std::fill(scalars + available, scalars + numOfParticels, 0.0f);
   }
+  scalarStream.unmap();
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, numOfParticels * sizeof(glm::vec2), p->GetPositions().data());
+const AlignedBuffer<float> &Game::colorFieldValues() const
+{
+  switch (colorField)
+  {
+  case ColorField::Density:
+    return snapshot->densities;
+  case ColorField::Pressure:
+    return snapshot->pressures;
+  default:
+    return snapshot->speed;
+  }
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, numOfParticels * sizeof(glm::vec3), colors.data());
+glm::vec2 Game::defaultColorRange(ColorField field) const
+{
+  switch (field)
+  {
+  case ColorField::Density:
+    return glm::vec2(0.0f, 2.0f * controls.targetDensity);
+  case ColorField::Pressure:
+    return glm::vec2(-0.5f, 0.5f) * controls.targetDensity * controls.pressureMultiplier;
+  default:
+    return glm::vec2(0.0f, 5.0f);
+  }
 }
 
 void Game::handleEvent()
@@ -192,11 +332,78 @@ void Game::handleEvent()
     {
       if (event.key.key == SDLK_UP)
       {
-        p->GetRadius() += 1.0f;
+        controls.radius += 1.0f;
+        submitControls();
       }
     }
 
-    p->OnEvent(event);
+    handleMouseEvent(event);
+  }
+
+  float mx, my;
+  SDL_GetMouseState(&mx, &my);
+  glm::vec2 mouseWorldPos = {(mx - WINDOW_W / 2.0f) / 100.0f, -(WINDOW_H / 2.0f - my) / 100.0f};
+  bool left = leftMouseDown, right = rightMouseDown;
+  simulation.submit([=](Particle &p)
+                    { p.setMouseState(mouseWorldPos, left, right); });
+}
+
+void Game::handleMouseEvent(SDL_Event &e)
+{
+  float mx, my;
+  SDL_GetMouseState(&mx, &my);
+
+  float worldX = (mx - WINDOW_W / 2.0f) / 100.0f;
+  float worldY = (WINDOW_H / 2.0f - my) / 100.0f;
+  glm::vec2 mouseWorldPos = {worldX, -worldY};
+
+  if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN)
+  {
+    if (e.button.button == SDL_BUTTON_LEFT)
+    {
+      leftMouseDown = true;
+      simulation.submit([=](Particle &p)
+                        { p.applyMousePressure(mouseWorldPos, 10.0f, 1.0f); });
+    }
+    else if (e.button.button == SDL_BUTTON_RIGHT)
+    {
+      rightMouseDown = true;
+      simulation.submit([=](Particle &p)
+                        { p.applyMousePressure(mouseWorldPos, -1.0f, 4.0f); });
+    }
+    else if (e.button.button == SDL_BUTTON_MIDDLE)
+    {
+      // answered from the solver thread, which owns the grid
+      simulation.submit([=](Particle &p)
+                        {
+                          float z = p.calculateDensity(mouseWorldPos);
+                          std::cout << "Density: " << z << " | Pressure: " << p.convertDensityToPressure(z) << std::endl;
+                        });
+    }
+  }
+  else if (e.type == SDL_EVENT_MOUSE_BUTTON_UP)
+  {
+    if (e.button.button == SDL_BUTTON_LEFT)
+    {
+      leftMouseDown = false;
+    }
+    else if (e.button.button == SDL_BUTTON_RIGHT)
+    {
+      rightMouseDown = false;
+    }
+  }
+  else if (e.type == SDL_EVENT_MOUSE_MOTION)
+  {
+    if (e.motion.state & SDL_BUTTON_LMASK)
+    {
+      simulation.submit([=](Particle &p)
+                        { p.applyMousePressure(mouseWorldPos, 1.0f, 0.8f); });
+    }
+    else if (e.motion.state & SDL_BUTTON_RMASK)
+    {
+      simulation.submit([=](Particle &p)
+                        { p.applyMousePressure(mouseWorldPos, -0.3f, 4.0f); });
+    }
   }
 }
 
@@ -215,27 +422,49 @@ void Game::render()
     frameTimePrev = currentTime;
   }
 
-  glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
-
-  shader->use();
-
-  shader->setFloat("pointSize", p->GetRadius() * 2.0f);
-  shader->setVec2("screenSize", glm::vec2(WINDOW_W, WINDOW_H));
-  shader->setScale("worldScale", UNITMULTIPLIER);
-  glUniform1f(glGetUniformLocation(shader->ID, "uAlpha"), p->alpha);
+  {
+    SPH_PROFILE_SCOPE(frameProfiler, Draw);
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    shader->use();
+
+    shader->setFloat("pointSize", controls.radius * 2.0f);
+    shader->setVec2("screenSize", glm::vec2(WINDOW_W, WINDOW_H));
+    shader->setScale("worldScale", UNITMULTIPLIER);
+    glUniform1f(glGetUniformLocation(shader->ID, "uAlpha"), controls.alpha);
+    shader->setVec2("colorRange", colorRange);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_1D, colormapTexture);
+    glBindVertexArray(VAO);
+    // both streams map the same region each frame
+    glDrawArrays(GL_POINTS, positionStream.firstElement(), numOfParticels);
+    positionStream.fence();
+    scalarStream.fence();
+  }
 
-  glBindVertexArray(VAO);
-  glDrawArrays(GL_POINTS, 0, numOfParticels);
+  {
+    SPH_PROFILE_SCOPE(frameProfiler, Gui);
+    ImguiRender();
+  }
 
-  ImguiRender();
+  {
+    SPH_PROFILE_SCOPE(frameProfiler, Swap);
+    SDL_GL_SwapWindow(window);
+  }
 
-  SDL_GL_SwapWindow(window);
+  SPH_PROFILE_FRAME(frameProfiler);
 }
 
 void Game::clear()
 {
+  simulation.stop();
   shader->destroy();
+  glDeleteTextures(1, &colormapTexture);
+  positionStream.destroy();
+  scalarStream.destroy();
+  glDeleteVertexArrays(1, &VAO);
 
   delete shader;
   SDL_GL_DestroyContext(context);
@@ -265,56 +494,265 @@ void Game::ImguiRender()
 
   ImGui::Begin("Debug");
   ImGui::Text("Hello from ImGui!");
-  ImGui::SliderFloat("Gravity", &p->GRAVITY, 0.0f, 100.0f);
+  // every widget edits `controls`; one copy goes to the solver if any of them changed
+  bool changed = false;
+  const SolverStats &stats = snapshot->stats;
+  changed |= ImGui::SliderFloat("Gravity", &controls.gravity, 0.0f, 100.0f);
   // ImGui::SliderFloat("Damping", &p->damping, 0.0f, 3.0f);
-  if (ImGui::SliderFloat("Radius", &p->GetRadius(), 0.0f, 10.0f))
-    ;
-  if (ImGui::SliderFloat("mass", &p->mass, 0.0f, 10.0f))
-    ;
-  ImGui::SliderFloat("alpha", &p->alpha, 0.0f, 1.0f);
+  changed |= ImGui::SliderFloat("Radius", &controls.radius, 0.0f, 10.0f);
+  changed |= ImGui::SliderFloat("mass", &controls.mass, 0.0f, 10.0f);
+  ImGui::SliderFloat("alpha", &controls.alpha, 0.0f, 1.0f);
 
-  if (ImGui::SliderInt("numParticles", &p->numParticles, 0, 3500) ||
-      ImGui::SliderFloat("spacing", &p->particleSpacing, 0.0f, 2.0f))
+  if (ImGui::SliderInt("numParticles", &sceneParticles, 0, kMaxParticles) ||
+      ImGui::SliderFloat("spacing", &controls.particleSpacing, 0.0f, 2.0f))
   {
-    p->MakeGrid();
-    previousNumParticles = -1;
+    int count = sceneParticles;
+    float spacing = controls.particleSpacing;
+    simulation.submit([=](Particle &p)
+                      {
+                        p.numParticles = count;
+                        p.particleSpacing = spacing;
+                        p.MakeGrid();
+                      });
   }
 
-  if (ImGui::SliderFloat("smoothign Radius", &p->smoothingRadius, 0.0f, 10.0f))
+  if (ImGui::Checkbox("inflow / outflow", &pipes))
   {
-    p->recalculateSRConstant();
+    std::vector<ParticleEmitter> emitters;
+    std::vector<KillVolume> killVolumes;
+    if (pipes)
+    {
+      // a pipe high on the left wall and a drain in the floor at the right end
+      // (+y points down)
+      float halfW = WINDOW_W / 2.0f / UNITMULTIPLIER;
+      float halfH = WINDOW_H / 2.0f / UNITMULTIPLIER;
+      emitters.push_back({{-halfW + 0.1f, -0.3f * halfH}, {3.0f, 0.0f}, 0.6f});
+      killVolumes.push_back({{halfW - 1.0f, halfH - 0.3f}, {halfW, halfH}});
+    }
+    simulation.submit([=](Particle &p)
+                      {
+                        p.emitters = emitters;
+                        p.killVolumes = killVolumes;
+                      });
+  }
+  ImGui::Text("particles: %d, %lld emitted, %lld removed", stats.numParticles, stats.particlesEmitted,
+              stats.particlesRemoved);
+
+  changed |= ImGui::SliderFloat("smoothign Radius", &controls.smoothingRadius, 0.0f, 10.0f);
+  changed |= ImGui::SliderFloat("target Density", &controls.targetDensity, 0.0f, 20.0f);
+  changed |= ImGui::SliderFloat("pressureMultiplier", &controls.pressureMultiplier, 0.0f, 200.0f);
+  if (ImGui::SliderInt("threads", &threadCount, 1, std::max(1, (int)std::thread::hardware_concurrency())))
+  {
+    int count = threadCount;
+    simulation.submit([=](Particle &p)
+                      { p.setThreadCount(count); });
   }
-  ImGui::SliderFloat("target Density", &p->targetDensity, 0.0f, 20.0f);
-  ImGui::SliderFloat("pressureMultiplier", &p->pressureMultiplier, 0.0f, 200.0f);
-  ImGui::Checkbox("start", &p->running);
+  changed |= ImGui::Checkbox("SIMD kernels", &controls.useSimdKernels);
+  if (controls.useSimdKernels)
+  {
+    const char *levels[] = {"scalar", "SSE4", "AVX2", "AVX-512"};
+    int level = (int)controls.simdLevel;
+    if (ImGui::Combo("SIMD level", &level, levels, (int)detectSimdLevel() + 1))
+    {
+      controls.simdLevel = (SimdLevel)level;
+      changed = true;
+    }
+  }
+  const char *formulations[] = {"shared pressure", "symmetric"};
+  int formulation = (int)controls.pressureFormulation;
+  if (ImGui::Combo("pressure force", &formulation, formulations, 2))
+  {
+    controls.pressureFormulation = (PressureFormulation)formulation;
+    changed = true;
+  }
+  changed |= ImGui::Checkbox("neighbor cache", &controls.useNeighborCache);
+  changed |= ImGui::Checkbox("verlet list", &controls.useVerletList);
+  changed |= ImGui::Checkbox("half list", &controls.useHalfNeighborList);
+  if (controls.useVerletList)
+  {
+    changed |= ImGui::SliderFloat("skin", &controls.neighborSkin, 0.0f, 0.2f);
+    ImGui::Text("list builds: %d / %d substeps", stats.neighborListBuilds, stats.neighborListSubsteps);
+  }
+  changed |= ImGui::Checkbox("spatial reorder", &controls.useSpatialReorder);
+  if (controls.useSpatialReorder)
+  {
+    changed |= ImGui::SliderInt("reorder interval", &controls.reorderInterval, 1, 1000);
+    changed |= ImGui::SliderFloat("reorder threshold", &controls.reorderThreshold, 0.0f, 1.0f);
+  }
+  ImGui::Text("grid disorder: %.2f (%d reorders)", stats.gridDisorder, stats.reorderCount);
+  if (controls.usingNeighborList())
+  {
+    ImGui::Text("cache: %.1f KB, %d pairs", stats.neighborCacheBytes / 1024.0f, stats.neighborPairCount);
+    if (kProfilingEnabled && GetSolverProfiler().hasSamples(ProfilePhase::NeighborList))
+    {
+      ImGui::SameLine();
+      ImGui::Text(", build %.2f ms", GetSolverProfiler().stats(ProfilePhase::NeighborList).average);
+    }
+  }
+  const char *fields[] = {"speed", "density", "pressure"};
+  int field = (int)colorField;
+  if (ImGui::Combo("color by", &field, fields, 3))
+  {
+    colorField = (ColorField)field;
+    colorRange = defaultColorRange(colorField);
+  }
+  ImGui::DragFloatRange2("color range", &colorRange.x, &colorRange.y, 0.05f);
+  ImGui::Text("upload: %s, %lld stalls", uploadModeName(positionStream.mode()),
+              positionStream.stalls() + scalarStream.stalls());
+  ImGui::Text("arena: %.1f / %.1f MB for %d particles%s", stats.arenaUsedBytes / 1048576.0f,
+              stats.arenaBytes / 1048576.0f, stats.capacity, stats.arenaHugePages ? ", huge pages" : "");
+  ImGui::SliderFloat("sim rate (Hz)", &simRate, 30.0f, 480.0f);
+  changed |= ImGui::Checkbox("adaptive dt", &controls.useAdaptiveTimestep);
+  if (controls.useAdaptiveTimestep)
+  {
+    changed |= ImGui::SliderFloat("CFL", &controls.cflNumber, 0.05f, 1.0f);
+    changed |= ImGui::SliderFloat("force CFL", &controls.forceCflNumber, 0.05f, 1.0f);
+  }
+  else
+  {
+    changed |= ImGui::SliderInt("substeps", &controls.substeps, 1, 8);
+  }
+  ImGui::Text("substep: %.2f ms x %d, max speed %.2f, max accel %.1f", stats.lastSubstepDt * 1000.0f,
+              stats.lastSubsteps, stats.maxSpeed, stats.maxAcceleration);
+  ImGui::SliderInt("max steps / batch", &maxStepsPerFrame, 1, 32);
+  ImGui::Text("steps last batch: %d, dropped: %d", stats.stepsLastBatch, stats.droppedSteps);
+  changed |= ImGui::Checkbox("start", &controls.running);
+  if (changed)
+  {
+    submitControls();
+  }
+  if (ImGui::Button("save checkpoint"))
+  {
+    std::string path = checkpointPath;
+    simulation.submit([=](Particle &p)
+                      { p.saveCheckpoint(path.c_str()); });
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("load checkpoint"))
+  {
+    checkpointLoadPending = true;
+  }
+  bool recording = stats.recording;
+  if (ImGui::Checkbox("record", &recording))
+  {
+    if (recording)
+      simulation.startRecording(recordingPath, recorderOptions);
+    else
+      simulation.stopRecording();
+    recordingNote.clear();
+  }
+  ImGui::SameLine();
+  ImGui::Checkbox("quantize", &recorderOptions.quantize);
+  if (stats.recording)
+  {
+    ImGui::Text("%s: %lld frames, %lld dropped, solver waited %lld times", recordingPath.c_str(),
+                stats.framesRecorded, stats.framesDropped, stats.recorderStalls);
+  }
+  else if (!recordingNote.empty())
+  {
+    ImGui::Text("%s", recordingNote.c_str());
+  }
+  ImguiTimings();
   ImGui::End();
 
   ImGui::Render();
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-void Game::recreateBuffers()
+// the solver thread is stopped while its Particle is replaced, and the Debug
+// window picks up the loaded parameters. An active recording carries on with the
+// loaded scene, unless the checkpoint has another domain than the one in the
+// recording's header; then the recording is finished and the window says so
+void Game::loadCheckpoint()
+{
+  glm::vec2 domain = p->GetDomainHalfSize();
+  bool recording = snapshot->stats.recording;
+  simulation.stop(true);
+  if (p->loadCheckpoint(checkpointPath.c_str()))
+  {
+    controls = SolverControls::from(*p);
+    sceneParticles = p->numParticles;
+    pipes = !p->emitters.empty();
+  }
+  simulation.start(p);
+  if (recording && p->GetDomainHalfSize() != domain)
+  {
+    simulation.stopRecording();
+    recordingNote = recordingPath + " finished: " + checkpointPath + " has a different domain";
+  }
+}
+
+void Game::submitControls()
 {
+  SolverControls copy = controls;
+  simulation.submit([=](Particle &p)
+                    { copy.applyTo(p); });
+}
 
-  glDeleteBuffers(1, &VBO);
-  glDeleteBuffers(1, &colorVBO);
-  glDeleteVertexArrays(1, &VAO);
+// rolling stats over the last Profiler::kHistory frames, in milliseconds
+void Game::ImguiTimings()
+{
+  if (!ImGui::CollapsingHeader("Timings"))
+    return;
 
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-  glGenBuffers(1, &colorVBO);
+  if (!kProfilingEnabled)
+  {
+    ImGui::Text("built without SPH_PROFILE");
+    return;
+  }
+
+  if (!ImGui::BeginTable("timings", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+    return;
+
+  const char *columns[] = {"phase", "last", "avg", "p50", "p95", "p99"};
+  for (const char *column : columns)
+  {
+    ImGui::TableSetupColumn(column);
+  }
+  ImGui::TableHeadersRow();
+
+  for (const Profiler *profiler : {&GetSolverProfiler(), &frameProfiler})
+  {
+    for (int i = 0; i < Profiler::kPhaseCount; i++)
+    {
+      ProfilePhase phase = (ProfilePhase)i;
+      if (!profiler->hasSamples(phase))
+        continue;
+
+      PhaseStats stats = profiler->stats(phase);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(profilePhaseName(phase));
+      for (float value : {stats.last, stats.average, stats.p50, stats.p95, stats.p99})
+      {
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", value);
+      }
+    }
+  }
+
+  ImGui::EndTable();
+}
+
+// recreates both vertex streams with room for `capacity` particles. Persistent
+// storage is immutable, so the buffers are new and the VAO is pointed at them
+// again. Every frame writes all live particles, so nothing needs copying here
+void Game::growBuffers(int capacity)
+{
+  bufferCapacity = capacity;
+
+  positionStream.create(sizeof(glm::vec2), bufferCapacity, uploadMode);
+  scalarStream.create(sizeof(float), bufferCapacity, uploadMode);
 
   glBindVertexArray(VAO);
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, numOfParticels * sizeof(glm::vec2), p->GetPositions().data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, positionStream.buffer());
   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void *)0);
   glEnableVertexAttribArray(0);
 
-  glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-  glBufferData(GL_ARRAY_BUFFER, numOfParticels * sizeof(glm::vec3), colors.data(), GL_DYNAMIC_DRAW);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
+  glBindBuffer(GL_ARRAY_BUFFER, scalarStream.buffer());
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
   glEnableVertexAttribArray(1);
 
   glBindVertexArray(0);
-}
\ No newline at end of file
+}
@@ -1,19 +1,55 @@
 #include "game.h"
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
 
 Game game;
 
 int main(int argc, char *argv[])
 {
-  game.init("Fluid Simulator", 1280, 720);
-  Uint64 frameTimePrev = SDL_GetTicks();
+  int threads = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "-t") == 0) && i + 1 < argc)
+    {
+      threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--sim-rate") == 0 && i + 1 < argc)
+    {
+      game.simRate = std::max(1.0f, (float)atof(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--upload") == 0 && i + 1 < argc)
+    {
+      // persistent (GL 4.4 mapped ring, the default) or orphan (GL 3.3 fallback)
+      i++;
+      game.uploadMode = strcmp(argv[i], "orphan") == 0 ? UploadMode::Orphan : UploadMode::Persistent;
+    }
+    else if (strcmp(argv[i], "--check-simd") == 0)
+    {
+      // compares every vector kernel this CPU supports against the scalar one
+      bool ok = true;
+      for (int level = 1; level <= (int)detectSimdLevel(); level++)
+      {
+        float error = checkSimdKernels((SimdLevel)level);
+        std::cout << simdLevelName((SimdLevel)level) << ": max relative error " << error << std::endl;
+        ok = ok && error < 1e-4f;
+      }
+      return ok ? 0 : 1;
+    }
+  }
+
+  game.init("Fluid Simulator", 1280, 720, threads);
+  Uint64 frameTimePrev = SDL_GetTicksNS();
   while (game.running())
   {
     game.handleEvent();
 
-    Uint64 currentTime = SDL_GetTicks();
-    float dt = (currentTime - frameTimePrev) / 1000.0f; // seconds
+    // wall-clock frame time; the solver thread keeps its own clock
+    Uint64 currentTime = SDL_GetTicksNS();
+    float dt = (currentTime - frameTimePrev) / 1e9f; // seconds
     frameTimePrev = currentTime;
-    
+
     game.update(dt);
 
     game.render();
@@ -45,6 +45,15 @@ Shader::Shader(const char * vertexPath, const char * fragmentPath){
   glDeleteShader(fragment);
 }
 
+void Shader::setInt(const std::string &name, int value) const {
+    GLint loc = glGetUniformLocation(ID, name.c_str());
+    if (loc == -1) {
+        std::cerr << "Warning: Uniform '" << name << "' not found!" << std::endl;
+        return;
+    }
+    glUniform1i(loc, value);
+}
+
 void Shader::setFloat(const std::string &name, float value) const {
     GLint loc = glGetUniformLocation(ID, name.c_str());
     if (loc == -1) {
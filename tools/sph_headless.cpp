@@ -0,0 +1,356 @@
+// Runs the solver without a window: reads a scene config, advances it a fixed
+// number of steps and writes particle state as CSV.
+//
+//   sph_headless [scenes/block_drop.cfg] [key=value ...]
+//
+// Every config key can be overridden on the command line, and without a scene
+// file every key takes its default. See scenes/ for the available keys. resume=file starts from a checkpoint instead of building the
+// scene, and checkpoint=file writes one after the last step. record=file writes
+// every record_every-th step to a recording (see Recorder.h) in the background;
+// the solver waits for the writer when it falls behind, and record_block=0 drops
+// those steps instead (with a warning at the end).
+// check_simd=1 compares every vector kernel this CPU supports against the scalar
+// one and exits without running a scene (`sph_headless check_simd=1`).
+
+#include "Particle.h"
+#include "Recorder.h"
+#include "SimdKernels.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// each value remembers where it was set ("file:line" or "command line") for errors
+struct ConfigValue
+{
+    std::string text;
+    std::string origin;
+};
+using Config = std::map<std::string, ConfigValue>;
+
+static std::string trim(const std::string &s)
+{
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static bool parseLine(const std::string &line, const std::string &origin, Config &config)
+{
+    std::string text = trim(line.substr(0, line.find('#')));
+    if (text.empty())
+        return true;
+
+    size_t eq = text.find('=');
+    if (eq == std::string::npos)
+        return false;
+
+    config[trim(text.substr(0, eq))] = {trim(text.substr(eq + 1)), origin};
+    return true;
+}
+
+static bool loadConfig(const char *path, Config &config)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "ERROR: Could not open config file: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::string origin = std::string(path) + ":" + std::to_string(lineNumber);
+        if (!parseLine(line, origin, config))
+        {
+            std::cerr << origin << ": expected key = value" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// a value that is not a number, or does not fit, ends the run with an error
+[[noreturn]] static void badValue(const char *key, const ConfigValue &value, const char *expected)
+{
+    std::cerr << value.origin << ": " << key << " expects " << expected << ", got \"" << value.text << "\"" << std::endl;
+    std::exit(1);
+}
+
+static float getFloat(const Config &config, const char *key, float fallback)
+{
+    auto it = config.find(key);
+    if (it == config.end())
+        return fallback;
+
+    try
+    {
+        size_t used = 0;
+        float value = std::stof(it->second.text, &used);
+        if (used == it->second.text.size())
+            return value;
+    }
+    catch (const std::invalid_argument &)
+    {
+    }
+    catch (const std::out_of_range &)
+    {
+    }
+    badValue(key, it->second, "a number");
+}
+
+static int getInt(const Config &config, const char *key, int fallback)
+{
+    auto it = config.find(key);
+    if (it == config.end())
+        return fallback;
+
+    try
+    {
+        size_t used = 0;
+        int value = std::stoi(it->second.text, &used);
+        if (used == it->second.text.size())
+            return value;
+    }
+    catch (const std::invalid_argument &)
+    {
+    }
+    catch (const std::out_of_range &)
+    {
+    }
+    badValue(key, it->second, "an integer");
+}
+
+static std::string getString(const Config &config, const char *key, const char *fallback)
+{
+    auto it = config.find(key);
+    return it == config.end() ? fallback : it->second.text;
+}
+
+// "a b c; d e f" -> {{a, b, c}, {d, e, f}}, each group must have `width` numbers
+static bool getGroups(const Config &config, const char *key, size_t width, std::vector<std::vector<float>> &groups)
+{
+    auto it = config.find(key);
+    if (it == config.end())
+        return true;
+
+    std::stringstream list(it->second.text);
+    std::string group;
+    while (std::getline(list, group, ';'))
+    {
+        std::stringstream numbers(group);
+        std::vector<float> values;
+        float value;
+        while (numbers >> value)
+            values.push_back(value);
+        if (values.empty())
+            continue;
+        if (values.size() != width)
+        {
+            std::cerr << it->second.origin << ": " << key << " expects groups of " << width << " numbers" << std::endl;
+            return false;
+        }
+        groups.push_back(values);
+    }
+    return true;
+}
+
+static bool writeState(Particle &p, const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        std::cerr << "ERROR: Could not write " << path << std::endl;
+        return false;
+    }
+
+    const Vec2Array &positions = p.GetPositions();
+    const Vec2Array &velocities = p.GetVelocities();
+
+    out.precision(9);
+    out << "id,x,y,vx,vy,density\n";
+    for (int i = 0; i < p.numParticles; i++)
+    {
+        glm::vec2 pos = positions[i];
+        glm::vec2 vel = velocities[i];
+        out << p.GetParticleId(i) << ',' << pos.x << ',' << pos.y << ','
+            << vel.x << ',' << vel.y << ',' << p.densities[i] << '\n';
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [scene.cfg] [key=value ...]" << std::endl;
+        return 1;
+    }
+
+    // the scene file is optional, every key has a default
+    Config config;
+    int first = 1;
+    if (std::string(argv[1]).find('=') == std::string::npos)
+    {
+        if (!loadConfig(argv[1], config))
+            return 1;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; i++)
+    {
+        if (!parseLine(argv[i], "command line", config))
+        {
+            std::cerr << "ERROR: expected key=value, got " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (getInt(config, "check_simd", 0) != 0)
+    {
+        bool ok = true;
+        for (int level = 1; level <= (int)detectSimdLevel(); level++)
+        {
+            float error = checkSimdKernels((SimdLevel)level);
+            std::cout << simdLevelName((SimdLevel)level) << ": max relative error " << error << std::endl;
+            ok = ok && error < 1e-4f;
+        }
+        return ok ? 0 : 1;
+    }
+
+    int width = getInt(config, "width", 1280);
+    int height = getInt(config, "height", 720);
+    unsigned int seed = (unsigned int)getInt(config, "seed", 1);
+
+    Particle p(width, height, seed);
+    p.setThreadCount(getInt(config, "threads", 1));
+
+    // a checkpoint brings its own scene and parameters; keys given in the config
+    // still override the parameters, but not the particles, emitters or kill volumes
+    std::string resume = getString(config, "resume", "");
+    if (!resume.empty() && !p.loadCheckpoint(resume.c_str()))
+        return 1;
+
+    p.GRAVITY = getFloat(config, "gravity", p.GRAVITY);
+    p.mass = getFloat(config, "mass", p.mass);
+    p.radius = getFloat(config, "radius", p.radius);
+    p.particleSpacing = getFloat(config, "spacing", p.particleSpacing);
+    p.smoothingRadius = getFloat(config, "smoothing_radius", p.smoothingRadius);
+    p.recalculateSRConstant();
+    Particle::targetDensity = getFloat(config, "target_density", Particle::targetDensity);
+    Particle::pressureMultiplier = getFloat(config, "pressure_multiplier", Particle::pressureMultiplier);
+
+    p.useNeighborCache = getInt(config, "neighbor_cache", p.useNeighborCache) != 0;
+    p.useVerletList = getInt(config, "verlet", p.useVerletList) != 0;
+    p.useHalfNeighborList = getInt(config, "half_list", p.useHalfNeighborList) != 0;
+    p.neighborSkin = getFloat(config, "skin", p.neighborSkin);
+    p.useSpatialReorder = getInt(config, "reorder", p.useSpatialReorder) != 0;
+    p.useSimdKernels = getInt(config, "simd", p.useSimdKernels) != 0;
+
+    p.neighborsPerParticle = getInt(config, "neighbors_per_particle", p.neighborsPerParticle);
+    if (resume.empty())
+    {
+        p.numParticles = getInt(config, "particles", p.numParticles);
+        p.reserveCapacity(getInt(config, "capacity", p.numParticles));
+        p.MakeGrid();
+    }
+    p.running = true;
+
+    int steps = getInt(config, "steps", 1000);
+    float dt = getFloat(config, "dt", 1.0f / 120.0f);
+    p.substeps = getInt(config, "substeps", p.substeps);
+    p.useAdaptiveTimestep = getInt(config, "adaptive", p.useAdaptiveTimestep) != 0;
+    p.cflNumber = getFloat(config, "cfl", p.cflNumber);
+    p.forceCflNumber = getFloat(config, "force_cfl", p.forceCflNumber);
+    bool symmetric = getInt(config, "symmetric", p.pressureFormulation == PressureFormulation::Symmetric) != 0;
+    p.pressureFormulation = symmetric ? PressureFormulation::Symmetric : PressureFormulation::SharedPressure;
+
+    std::vector<std::vector<float>> emitters, killVolumes;
+    if (!getGroups(config, "emitters", 5, emitters) || !getGroups(config, "kill_volumes", 4, killVolumes))
+        return 1;
+    // like the particles, a resumed run keeps the checkpoint's emitters (with
+    // their progress towards the next row) and kill volumes
+    if (!resume.empty())
+    {
+        emitters.clear();
+        killVolumes.clear();
+    }
+    for (const std::vector<float> &e : emitters)
+    {
+        p.emitters.push_back({{e[0], e[1]}, {e[2], e[3]}, e[4]});
+    }
+    for (const std::vector<float> &k : killVolumes)
+    {
+        p.killVolumes.push_back({{k[0], k[1]}, {k[2], k[3]}});
+    }
+
+    int outputEvery = getInt(config, "output_every", 0);
+    std::string output = getString(config, "output", "sph_output");
+
+    FrameRecorder recorder;
+    std::string recording = getString(config, "record", "");
+    if (!recording.empty())
+    {
+        RecorderOptions options;
+        options.every = getInt(config, "record_every", options.every);
+        options.quantize = getInt(config, "record_quantize", options.quantize) != 0;
+        options.compress = getInt(config, "record_compress", options.compress) != 0;
+        // an offline run wants every frame, so unlike the viewer it waits for the writer
+        options.blockWhenFull = getInt(config, "record_block", 1) != 0;
+        if (!recorder.open(recording.c_str(), p, options))
+            return 1;
+    }
+
+    long long particleSteps = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 1; step <= steps; step++)
+    {
+        p.update(dt);
+        particleSteps += p.numParticles;
+        recorder.capture(p, step);
+
+        if (outputEvery > 0 && step % outputEvery == 0)
+        {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "_%06d.csv", step);
+            if (!writeState(p, output + suffix))
+                return 1;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!recorder.close())
+        return 1;
+
+    if (!writeState(p, output + ".csv"))
+        return 1;
+
+    std::string checkpoint = getString(config, "checkpoint", "");
+    if (!checkpoint.empty() && !p.saveCheckpoint(checkpoint.c_str()))
+        return 1;
+
+    std::cout << p.numParticles << " particles, " << steps << " steps in " << seconds << " s ("
+              << particleSteps / seconds << " particle-steps/s, "
+              << p.substepsTaken << " substeps)" << std::endl;
+    if (!p.emitters.empty() || !p.killVolumes.empty())
+        std::cout << p.particlesEmitted << " emitted, " << p.particlesRemoved << " removed" << std::endl;
+    if (!recording.empty())
+        std::cout << recorder.framesRecorded() << " frames recorded, " << recorder.writtenBytes() / 1024 << " KB ("
+                  << (double)recorder.rawBytes() / recorder.writtenBytes() << "x), "
+                  << recorder.framesDropped() << " dropped, solver waited " << recorder.stalls() << " times"
+                  << std::endl;
+    if (recorder.framesDropped() > 0)
+        std::cerr << "WARNING: " << recording << " is missing " << recorder.framesDropped()
+                  << " frames the writer could not keep up with; record_block=1 keeps them" << std::endl;
+    return 0;
+}